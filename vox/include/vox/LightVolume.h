@@ -0,0 +1,334 @@
+#ifndef VOX_LIGHTVOLUME_H_
+#define VOX_LIGHTVOLUME_H_
+
+#include <string.h>
+
+#include <vox/vox.h>
+#include <vox/util/RawList.h>
+#include <vox/util/Trace.h>
+
+
+namespace vox {
+
+/*
+ * Flood-filled block and sky light for a volume, stored next to it with one byte per voxel
+ * and the same indexing: block light in the low nibble, sky light in the high nibble.
+ *
+ * Light spreads through air and loses one level per voxel. Sky light enters through the top
+ * of the volume and travels straight down without losing any. Solid voxels are opaque, but
+ * voxels with an emission (see the emission table, indexed by voxel type) light themselves
+ * and their surroundings.
+ *
+ * Only sky light crosses into neighbouring volumes, and only downwards: Propagate takes the
+ * sky light that enters through the top, which GetSkyBelow of the volume above provides.
+ * Without it, the top of the volume is open sky.
+ *
+ * After Propagate, keep the light up to date by calling Update after every SetVoxel.
+ * Volumes sized at runtime get their light memory in Propagate, which takes the size of the volume.
+ */
+template <typename VoxelType, typename VolumeType, VoxelType kEmptyCubeIndex = 0>
+class LightVolume {
+public:
+    static const u8 kMaxLight = 15;
+    static const u32 kBlockShift = 0;
+    static const u32 kSkyShift = 4;
+
+private:
+    u8* data_;
+    const u8* voxel_emission_;
+
+    /* The sky light that enters each column through the top, indexed by z * width + x. */
+    u8* sky_;
+
+    /* The size of the volume that was lit last. Both buffers only ever grow. */
+    VoxSize width_;
+    VoxSize height_;
+    VoxSize depth_;
+    size_t data_capacity_;
+    size_t sky_capacity_;
+
+    RawList<u32> add_queue_;
+    RawList<u32> remove_queue_;
+
+    inline VoxSize width () const { return (VolumeType::kWidth != kRuntimeSize) ? VolumeType::kWidth : width_; }
+    inline VoxSize height () const { return (VolumeType::kHeight != kRuntimeSize) ? VolumeType::kHeight : height_; }
+    inline VoxSize depth () const { return (VolumeType::kDepth != kRuntimeSize) ? VolumeType::kDepth : depth_; }
+    inline size_t layer_size () const { return (size_t) width () * depth (); }
+    inline size_t voxel_count () const { return layer_size () * height (); }
+
+    void SetSize (const VoxSize width, const VoxSize height, const VoxSize depth) {
+        width_ = width;
+        height_ = height;
+        depth_ = depth;
+
+        if (voxel_count () > data_capacity_) {
+            delete[] data_;
+            data_capacity_ = voxel_count ();
+            data_ = new u8[data_capacity_];
+            memset (data_, 0, data_capacity_ * sizeof (u8));
+        }
+        if (layer_size () > sky_capacity_) {
+            delete[] sky_;
+            sky_capacity_ = layer_size ();
+            sky_ = new u8[sky_capacity_];
+            memset (sky_, kMaxLight, sky_capacity_ * sizeof (u8));
+        }
+    }
+
+    inline u8 GetLevel (const size_t index, const u32 shift) const {
+        return (data_[index] >> shift) & 0x0F;
+    }
+
+    inline void SetLevel (const size_t index, const u32 shift, const u8 level) {
+        data_[index] = (u8) ((data_[index] & ~(0x0F << shift)) | (level << shift));
+    }
+
+    inline u8 GetEmission (const VoxelType voxel) const {
+        return (voxel_emission_ != NULL) ? voxel_emission_[voxel] : 0;
+    }
+
+    /* The light that the voxel at 'index' has regardless of its neighbours. */
+    inline u8 GetSource (const VolumeType& volume, const size_t index, const u32 shift) const {
+        const VoxelType voxel = volume.data ()[index];
+        if (shift == kBlockShift) {
+            return GetEmission (voxel);
+        }
+
+        VoxPos x, y, z;
+        volume.GetVoxelPosition (index, x, y, z);
+        if (voxel == kEmptyCubeIndex && y == volume.height () - 1) {
+            return sky_[z * volume.width () + x];
+        }
+        return 0;
+    }
+
+    template<typename T>
+    inline static void Push (RawList<T>& list, const T value) {
+        if (list.iterator () >= list.size ()) {
+            list.Resize (list.iterator () + 1);
+        }
+        list.Next () = value;
+    }
+
+    /* Returns the number of neighbours and writes their indices. 'below' is the neighbour under the voxel, if any. */
+    inline static int GetNeighbours (const VolumeType& volume, const size_t index, size_t* neighbours, int& below) {
+        VoxPos x, y, z;
+        volume.GetVoxelPosition (index, x, y, z);
+
+        int count = 0;
+        below = -1;
+        if (x > 0) neighbours[count++] = index - 1;
+        if (x < volume.width () - 1) neighbours[count++] = index + 1;
+        if (z > 0) neighbours[count++] = index - volume.width ();
+        if (z < volume.depth () - 1) neighbours[count++] = index + volume.width ();
+        if (y < volume.height () - 1) neighbours[count++] = index + volume.area ();
+        if (y > 0) {
+            below = count;
+            neighbours[count++] = index - volume.area ();
+        }
+        return count;
+    }
+
+    /* The level that 'level' spreads to a neighbour. Full sky light falls down without loss. */
+    inline static u8 GetSpreadLevel (const u32 shift, const u8 level, const bool downwards) {
+        if (shift == kSkyShift && downwards && level == kMaxLight) {
+            return kMaxLight;
+        }
+        return level - 1;
+    }
+
+    void SpreadLight (const VolumeType& volume, const u32 shift) {
+        const VoxelType* voxels = volume.data ();
+
+        for (size_t head = 0; head < add_queue_.iterator (); ++head) {
+            const size_t index = add_queue_[head];
+            const u8 level = GetLevel (index, shift);
+            if (level <= 1) continue;
+
+            size_t neighbours[6];
+            int below;
+            const int count = GetNeighbours (volume, index, neighbours, below);
+            for (int i = 0; i < count; ++i) {
+                const size_t neighbour = neighbours[i];
+                if (voxels[neighbour] != kEmptyCubeIndex) continue;
+
+                const u8 spread = GetSpreadLevel (shift, level, i == below);
+                if (GetLevel (neighbour, shift) < spread) {
+                    SetLevel (neighbour, shift, spread);
+                    Push (add_queue_, (u32) neighbour);
+                }
+            }
+        }
+
+        add_queue_.ResetIterator ();
+    }
+
+    /*
+     * Removes all light that came from the voxel at 'index' with the given level.
+     * Neighbours that are lit from somewhere else are queued to spread their light back in.
+     */
+    void RemoveLight (const VolumeType& volume, const size_t index, const u32 shift) {
+        remove_queue_.ResetIterator ();
+        Push (remove_queue_, (u32) ((index << 4) | GetLevel (index, shift)));
+        SetLevel (index, shift, 0);
+
+        for (size_t head = 0; head < remove_queue_.iterator (); ++head) {
+            const size_t current = remove_queue_[head] >> 4;
+            const u8 level = remove_queue_[head] & 0x0F;
+
+            size_t neighbours[6];
+            int below;
+            const int count = GetNeighbours (volume, current, neighbours, below);
+            for (int i = 0; i < count; ++i) {
+                const size_t neighbour = neighbours[i];
+                const u8 neighbour_level = GetLevel (neighbour, shift);
+                if (neighbour_level == 0) continue;
+
+                /* Emitters and the sky keep their own light. */
+                const u8 emission = GetSource (volume, neighbour, shift);
+
+                /* Lower neighbours may have been lit by this voxel, and so may full sky light below full sky light. */
+                const bool dependent = (shift == kSkyShift && i == below && level == kMaxLight) ?
+                    neighbour_level == kMaxLight : neighbour_level < level;
+
+                if (dependent && neighbour_level > emission) {
+                    Push (remove_queue_, (u32) ((neighbour << 4) | neighbour_level));
+                    SetLevel (neighbour, shift, emission);
+                    if (emission > 0) {
+                        Push (add_queue_, (u32) neighbour);
+                    }
+                }else if (neighbour_level >= level || emission > 0) {
+                    Push (add_queue_, (u32) neighbour);
+                }
+            }
+        }
+    }
+
+
+public:
+    LightVolume (const u8* voxel_emission = NULL) {
+        data_ = NULL;
+        sky_ = NULL;
+        data_capacity_ = 0;
+        sky_capacity_ = 0;
+        voxel_emission_ = voxel_emission;
+
+        /* Nothing is allocated for runtime sized volumes, whose size is 0 here. */
+        SetSize (VolumeType::kWidth, VolumeType::kHeight, VolumeType::kDepth);
+    }
+
+    ~LightVolume () {
+        delete[] data_;
+        delete[] sky_;
+    }
+
+    /*
+     * Recomputes all light of the volume. 'sky' holds the sky light that enters each column
+     * through the top, indexed by z * width + x (see GetSkyBelow). NULL is open sky.
+     */
+    void Propagate (const VolumeType& volume, const u8* sky = NULL) {
+        VOX_TRACE_ZONE ("LightVolume::Propagate");
+
+        SetSize (volume.width (), volume.height (), volume.depth ());
+        memset (data_, 0, voxel_count () * sizeof (u8));
+        add_queue_.ResetIterator ();
+
+        if (sky != NULL) {
+            memcpy (sky_, sky, layer_size () * sizeof (u8));
+        }else {
+            memset (sky_, kMaxLight, layer_size () * sizeof (u8));
+        }
+
+        /* Sky light falls into every column from the top. Full sky light falls all the way down. */
+        const VoxSize width = volume.width ();
+        const VoxSize height = volume.height ();
+        const VoxSize depth = volume.depth ();
+        for (VoxPos z = 0; z < depth; ++z) {
+            for (VoxPos x = 0; x < width; ++x) {
+                const u8 level = sky_[z * width + x];
+                if (level == 0) continue;
+
+                for (VoxPos y = height; y > 0; --y) {
+                    const size_t index = volume.GetVoxelIndex (x, y - 1, z);
+                    if (volume.data ()[index] != kEmptyCubeIndex) break;
+                    SetLevel (index, kSkyShift, level);
+                    Push (add_queue_, (u32) index);
+                    if (level < kMaxLight) break;
+                }
+            }
+        }
+        SpreadLight (volume, kSkyShift);
+
+        if (voxel_emission_ != NULL) {
+            for (size_t index = 0; index < volume.volume (); ++index) {
+                const u8 emission = GetEmission (volume.data ()[index]);
+                if (emission > 0) {
+                    SetLevel (index, kBlockShift, emission);
+                    Push (add_queue_, (u32) index);
+                }
+            }
+            SpreadLight (volume, kBlockShift);
+        }
+    }
+
+    /* Brings the light up to date after the voxel at (x, y, z) has changed. */
+    void Update (const VolumeType& volume, const VoxPos x, const VoxPos y, const VoxPos z) {
+        VOX_TRACE_ZONE ("LightVolume::Update");
+
+        const size_t index = volume.GetVoxelIndex (x, y, z);
+        const VoxelType voxel = volume.GetVoxel (x, y, z);
+
+        for (u32 shift = kBlockShift; shift <= kSkyShift; shift += kSkyShift - kBlockShift) {
+            add_queue_.ResetIterator ();
+            RemoveLight (volume, index, shift);
+
+            /* New light sources. */
+            const u8 source = GetSource (volume, index, shift);
+            if (source > 0) {
+                SetLevel (index, shift, source);
+                Push (add_queue_, (u32) index);
+            }
+
+            /* Air lets the light of its neighbours back in. */
+            if (voxel == kEmptyCubeIndex) {
+                size_t neighbours[6];
+                int below;
+                const int count = GetNeighbours (volume, index, neighbours, below);
+                for (int i = 0; i < count; ++i) {
+                    if (GetLevel (neighbours[i], shift) > 0) {
+                        Push (add_queue_, (u32) neighbours[i]);
+                    }
+                }
+            }
+
+            SpreadLight (volume, shift);
+        }
+    }
+
+    /*
+     * Writes the sky light that leaves through the bottom of each column, which enters the volume below.
+     * 'sky' holds width * depth levels of the volume that was lit.
+     */
+    void GetSkyBelow (u8* sky) const {
+        for (size_t index = 0; index < layer_size (); ++index) {
+            const u8 level = GetLevel (index, kSkyShift);
+            sky[index] = (level == kMaxLight || level == 0) ? level : level - 1;
+        }
+    }
+
+    inline u8 GetBlockLight (const VoxPos x, const VoxPos y, const VoxPos z) const {
+        return (data_[(y * depth () + z) * width () + x] >> kBlockShift) & 0x0F;
+    }
+
+    inline u8 GetSkyLight (const VoxPos x, const VoxPos y, const VoxPos z) const {
+        return (data_[(y * depth () + z) * width () + x] >> kSkyShift) & 0x0F;
+    }
+
+    inline u8* data () const { return data_; }
+    inline const u8* sky () const { return sky_; }
+};
+
+}
+
+
+#endif  /* VOX_LIGHTVOLUME_H_ */
@@ -0,0 +1,212 @@
+#ifndef VOX_VISIBILITY_H_
+#define VOX_VISIBILITY_H_
+
+#include <string.h>
+
+#include <vox/vox.h>
+#include <vox/util/RawList.h>
+#include <vox/util/Trace.h>
+
+
+namespace vox {
+
+/*
+ * Faces of a volume. The opposite of a face is always 'face ^ 1'.
+ */
+static const int kFaceXNegative = 0;
+static const int kFaceXPositive = 1;
+static const int kFaceYNegative = 2;
+static const int kFaceYPositive = 3;
+static const int kFaceZNegative = 4;
+static const int kFaceZPositive = 5;
+static const int kFaceCount = 6;
+
+/*
+ * One bit per unordered pair of faces. A bit is set when the two faces are connected
+ * through air inside the volume, that is, when one face can potentially be seen through the other.
+ */
+typedef u16 VoxVisibility;
+
+static const VoxVisibility kVisibilityNone = 0;
+static const VoxVisibility kVisibilityAll = 0x7FFF;
+
+inline int GetOppositeFace (const int face) {
+    return face ^ 1;
+}
+
+inline VoxVisibility GetFacePairBit (const int a, const int b) {
+    static const u8 kPairIndex[kFaceCount][kFaceCount] = {
+        { 0xFF,    0,    1,    2,    3,    4 },
+        {    0, 0xFF,    5,    6,    7,    8 },
+        {    1,    5, 0xFF,    9,   10,   11 },
+        {    2,    6,    9, 0xFF,   12,   13 },
+        {    3,    7,   10,   12, 0xFF,   14 },
+        {    4,    8,   11,   13,   14, 0xFF }
+    };
+    return (a == b) ? 0 : (VoxVisibility) (1 << kPairIndex[a][b]);
+}
+
+inline bool CanSeeThrough (const VoxVisibility visibility, const int a, const int b) {
+    return (visibility & GetFacePairBit (a, b)) != 0;
+}
+
+/* Connects every pair of faces in 'face_mask', which has one bit per face. */
+inline VoxVisibility ConnectFaces (const u32 face_mask) {
+    VoxVisibility visibility = kVisibilityNone;
+    for (int a = 0; a < kFaceCount; ++a) {
+        if ((face_mask & (1 << a)) == 0) continue;
+        for (int b = a + 1; b < kFaceCount; ++b) {
+            if (face_mask & (1 << b)) {
+                visibility |= GetFacePairBit (a, b);
+            }
+        }
+    }
+    return visibility;
+}
+
+
+/*
+ * Computes the face connectivity of volumes with a flood fill over air voxels.
+ *
+ * Volumes only track which voxels changed between air and solid. Update recomputes
+ * the connectivity of a volume if and only if that happened since the last update:
+ *  - When air was only added, the old connectivity stays valid and only the components
+ *    around the opened voxels are flood filled.
+ *  - When air was removed, a component may have split, so the whole volume is flood filled.
+ *
+ * The builder owns the flood fill scratch memory, which grows with the largest volume it has seen,
+ * so use one builder per thread.
+ */
+template <typename VoxelType, typename VolumeType, VoxelType kEmptyCubeIndex = 0>
+class VisibilityBuilder {
+private:
+    RawList<u8> visited_;
+    RawList<u32> stack_;
+
+    template<typename T>
+    inline static void ReserveCapacity (RawList<T>& list, size_t needed) {
+        if (needed > list.size ()) {
+            list.Resize (needed);
+        }
+    }
+
+    /* Every voxel is pushed at most once, so the stack never has to grow during a flood fill. */
+    inline void Reset (const VolumeType& volume) {
+        ReserveCapacity (visited_, volume.volume ());
+        ReserveCapacity (stack_, volume.volume ());
+        memset (visited_.data (), 0, volume.volume () * sizeof (u8));
+    }
+
+    inline static u32 GetBoundaryFaces (const VolumeType& volume, const VoxPos x, const VoxPos y, const VoxPos z) {
+        u32 faces = 0;
+        if (x == 0) faces |= 1 << kFaceXNegative;
+        if (x == volume.width () - 1) faces |= 1 << kFaceXPositive;
+        if (y == 0) faces |= 1 << kFaceYNegative;
+        if (y == volume.height () - 1) faces |= 1 << kFaceYPositive;
+        if (z == 0) faces |= 1 << kFaceZNegative;
+        if (z == volume.depth () - 1) faces |= 1 << kFaceZPositive;
+        return faces;
+    }
+
+    inline void Visit (const VolumeType& volume, const VoxPos x, const VoxPos y, const VoxPos z, size_t& top) {
+        const u32 index = (u32) volume.GetVoxelIndex (x, y, z);
+        if (visited_[index] || volume.GetVoxel (x, y, z) != kEmptyCubeIndex) return;
+        visited_[index] = 1;
+        stack_[top++] = index;
+    }
+
+    /* Returns the faces that the air component around (x, y, z) touches. */
+    u32 FloodFill (const VolumeType& volume, const VoxPos x, const VoxPos y, const VoxPos z) {
+        u32 faces = 0;
+        size_t top = 0;
+        Visit (volume, x, y, z, top);
+
+        const VoxSize width = volume.width ();
+        const VoxSize height = volume.height ();
+        const VoxSize depth = volume.depth ();
+        while (top > 0) {
+            const u32 index = stack_[--top];
+            VoxPos vx, vy, vz;
+            volume.GetVoxelPosition (index, vx, vy, vz);
+
+            faces |= GetBoundaryFaces (volume, vx, vy, vz);
+
+            if (vx > 0) Visit (volume, vx - 1, vy, vz, top);
+            if (vx < width - 1) Visit (volume, vx + 1, vy, vz, top);
+            if (vy > 0) Visit (volume, vx, vy - 1, vz, top);
+            if (vy < height - 1) Visit (volume, vx, vy + 1, vz, top);
+            if (vz > 0) Visit (volume, vx, vy, vz - 1, top);
+            if (vz < depth - 1) Visit (volume, vx, vy, vz + 1, top);
+        }
+
+        return faces;
+    }
+
+
+public:
+    /* The scratch memory is sized on first use. */
+    VisibilityBuilder () {
+
+    }
+
+    VoxVisibility Compute (const VolumeType& volume) {
+        VOX_TRACE_ZONE ("VisibilityBuilder::Compute");
+
+        /* Empty volumes connect everything. */
+        const VoxSize width = volume.width ();
+        const VoxSize height = volume.height ();
+        const VoxSize depth = volume.depth ();
+        bool empty = true;
+        for (VoxPos y = 0; y < height; ++y) {
+            if (!volume.IsLayerYEmpty (y)) {
+                empty = false;
+                break;
+            }
+        }
+        if (empty) {
+            return kVisibilityAll;
+        }
+
+        Reset (volume);
+
+        /* Only components that touch the boundary can connect faces, so seed from boundary voxels. */
+        VoxVisibility visibility = kVisibilityNone;
+        for (VoxPos y = 0; y < height; ++y) {
+            for (VoxPos z = 0; z < depth; ++z) {
+                const bool z_boundary = y == 0 || y == height - 1 || z == 0 || z == depth - 1;
+                const VoxPos x_step = (z_boundary || width == 1) ? 1 : width - 1;
+                for (VoxPos x = 0; x < width; x += x_step) {
+                    const u32 index = (u32) volume.GetVoxelIndex (x, y, z);
+                    if (visited_[index] || volume.GetVoxel (x, y, z) != kEmptyCubeIndex) continue;
+                    visibility |= ConnectFaces (FloodFill (volume, x, y, z));
+                }
+            }
+        }
+
+        return visibility;
+    }
+
+    /* Recomputes the visibility of the volume if its air changed since the last update. */
+    VoxVisibility Update (VolumeType& volume) {
+        if (volume.visibility_dirty ()) {
+            volume.set_visibility (Compute (volume));
+        }else if (volume.visibility_pending_count () > 0) {
+            VOX_TRACE_ZONE ("VisibilityBuilder::Update");
+
+            Reset (volume);
+            VoxVisibility visibility = volume.visibility ();
+            for (u32 i = 0; i < volume.visibility_pending_count (); ++i) {
+                VoxPos x, y, z;
+                volume.GetVoxelPosition (volume.visibility_pending ()[i], x, y, z);
+                visibility |= ConnectFaces (FloodFill (volume, x, y, z));
+            }
+            volume.set_visibility (visibility);
+        }
+        return volume.visibility ();
+    }
+};
+
+}
+
+
+#endif  /* VOX_VISIBILITY_H_ */
@@ -3,14 +3,31 @@
 
 #include <string.h>
 
+#include <new>
+
 #include <coin/gl.h>
 
 #include <vox/vox.h>
 #include <vox/Region.h>
+#include <vox/Visibility.h>
+#include <vox/VolumePool.h>
+#include <vox/util/Trace.h>
 
 
 namespace vox {
 
+/*
+ * A size of kRuntimeSize is given to the constructor instead, which lets one Volume type
+ * (and one CubeGenerator) serve volumes of any size. Sizes known at compile time are faster.
+ *
+ * The voxels and the layer counts share one cache-aligned slab of memory, which is either
+ * allocated by the volume itself or taken from a VolumePool. Create places the volume
+ * itself into the pool as well.
+ *
+ * With clear_data set, a new volume is empty. Without it, the volume keeps whatever its memory
+ * holds, which for a slab from a VolumePool are the voxels of the volume that used it before.
+ * The layer counts are then counted from those voxels, which takes longer than clearing.
+ */
 template<typename Type, VoxSize kWidth, VoxSize kHeight, VoxSize kDepth>
 class Volume {
 private:
@@ -20,48 +37,212 @@ private:
     GLuint y_;
     GLuint z_;
 
+    VoxSize width_;
+    VoxSize height_;
+    VoxSize depth_;
+
     VoxArea* layer_x_block_count_;
     VoxArea* layer_y_block_count_;
     VoxArea* layer_z_block_count_;
 
+    void* slab_;
+    VolumePool<Type>* pool_;
+    bool placed_; /* Lives in front of its slab, see Create. */
+
+    /* See VisibilityBuilder. */
+    static const u32 kVisibilityMaxPending = 16;
+
+    VoxVisibility visibility_;
+    bool visibility_dirty_;
+    u32 visibility_pending_count_;
+    u32 visibility_pending_[kVisibilityMaxPending];
+
+    /* A voxel changed from solid to air. */
+    inline void OpenVisibility (const size_t index) {
+        if (visibility_dirty_) return;
+
+        if (visibility_pending_count_ < kVisibilityMaxPending) {
+            visibility_pending_[visibility_pending_count_] = (u32) index;
+            ++visibility_pending_count_;
+        }else { /* Too many changes, a full flood fill is cheaper. */
+            visibility_dirty_ = true;
+        }
+    }
+
+    /* A voxel changed from air to solid. */
+    inline void CloseVisibility () {
+        visibility_dirty_ = true;
+    }
+
+    void Initialize (void* slab, const GLuint x, const GLuint y, const GLuint z, const bool clear_data) {
+        const VolumeSlabLayout layout (width (), height (), depth (), sizeof (Type));
+        slab_ = slab;
+
+        data_ = (Type*) slab_;
+        if (clear_data) {
+            memset (data_, 0x00, data_size ());
+        }
+
+        x_ = x;
+        y_ = y;
+        z_ = z;
+        layer_x_block_count_ = (VoxArea*) ((u8*) slab_ + layout.layer_x_offset);
+        layer_y_block_count_ = (VoxArea*) ((u8*) slab_ + layout.layer_y_offset);
+        layer_z_block_count_ = (VoxArea*) ((u8*) slab_ + layout.layer_z_offset);
+        memset (layer_x_block_count_, 0, (width () + height () + depth ()) * sizeof (VoxArea));
+        if (!clear_data) {
+            CountLayers ();
+        }
+
+        /* Uncleared data is unknown, so its visibility has to be computed. */
+        visibility_ = kVisibilityAll;
+        visibility_dirty_ = !clear_data;
+        visibility_pending_count_ = 0;
+    }
+
+    /* Counts the solid voxels of every layer into the zeroed layer counts. */
+    void CountLayers () {
+        const VoxSize volume_width = width ();
+        const VoxSize volume_height = height ();
+        const VoxSize volume_depth = depth ();
+
+        const Type* voxel = data_;
+        for (VoxPos y = 0; y < volume_height; ++y) {
+            VoxArea layer_count = 0;
+            for (VoxPos z = 0; z < volume_depth; ++z) {
+                VoxArea row_count = 0;
+                for (VoxPos x = 0; x < volume_width; ++x, ++voxel) {
+                    if (*voxel != 0) {
+                        layer_x_block_count_[x] += 1;
+                        ++row_count;
+                    }
+                }
+                layer_z_block_count_[z] += row_count;
+                layer_count += row_count;
+            }
+            layer_y_block_count_[y] = layer_count;
+        }
+    }
+
+    inline static void* AllocateSlab (const VoxSize width, const VoxSize height, const VoxSize depth) {
+        return AllocateVolumeSlab (VolumeSlabLayout (width, height, depth, sizeof (Type)).size);
+    }
+
+    /* See Create. */
+    Volume (VolumePool<Type>& pool, void* slab, const GLuint x, const GLuint y, const GLuint z, const bool clear_data) {
+        width_ = pool.width ();
+        height_ = pool.height ();
+        depth_ = pool.depth ();
+        pool_ = &pool;
+        placed_ = true;
+        Initialize (slab, x, y, z, clear_data);
+    }
+
+    /* A copy would share the slab and give it back twice. Not implemented. */
+    Volume (const Volume&);
+    Volume& operator= (const Volume&);
+
 public:
     static const VoxSize kWidth = kWidth;
     static const VoxSize kHeight = kHeight;
     static const VoxSize kDepth = kDepth;
+    /* Both are 0 for runtime sized volumes, use area () and volume (). */
     static const VoxArea kLayerSize = kWidth * kDepth;
     static const VoxVolume kVolumeSize = kLayerSize * kHeight;
-    
+
     Volume (const GLuint x, const GLuint y, const GLuint z, const bool clear_data) {
-        data_ = new Type[kVolumeSize];
-        if (clear_data) {
-            memset (data_, 0x00, kVolumeSize * sizeof (Type));
-        }
+        static_assert (kWidth != kRuntimeSize && kHeight != kRuntimeSize && kDepth != kRuntimeSize,
+            "Runtime sized volumes need their size passed to the constructor.");
 
-        x_ = x;
-        y_ = y;
-        z_ = z;
-        layer_x_block_count_ = new VoxArea[kWidth];
-        layer_y_block_count_ = new VoxArea[kHeight];
-        layer_z_block_count_ = new VoxArea[kDepth];
-        memset (layer_x_block_count_, 0, kWidth * sizeof (VoxArea));
-        memset (layer_y_block_count_, 0, kHeight * sizeof (VoxArea));
-        memset (layer_z_block_count_, 0, kDepth * sizeof (VoxArea));
+        width_ = kWidth;
+        height_ = kHeight;
+        depth_ = kDepth;
+        pool_ = NULL;
+        placed_ = false;
+        Initialize (AllocateSlab (kWidth, kHeight, kDepth), x, y, z, clear_data);
+    }
+
+    /* Sizes that are known at compile time override the ones passed here. */
+    Volume (const VoxSize width, const VoxSize height, const VoxSize depth,
+            const GLuint x, const GLuint y, const GLuint z, const bool clear_data) {
+        width_ = (kWidth != kRuntimeSize) ? kWidth : width;
+        height_ = (kHeight != kRuntimeSize) ? kHeight : height;
+        depth_ = (kDepth != kRuntimeSize) ? kDepth : depth;
+        pool_ = NULL;
+        placed_ = false;
+        Initialize (AllocateSlab (width_, height_, depth_), x, y, z, clear_data);
+    }
+
+    /* Takes the size and the memory of the volume from 'pool', which has to outlive it. */
+    Volume (VolumePool<Type>& pool, const GLuint x, const GLuint y, const GLuint z, const bool clear_data) {
+        width_ = pool.width ();
+        height_ = pool.height ();
+        depth_ = pool.depth ();
+        pool_ = &pool;
+        placed_ = false;
+
+        if (width () != pool.width () || height () != pool.height () || depth () != pool.depth ()) {
+            printf ("Error: The VolumePool holds volumes of a different size!\n");
+            pool_ = NULL;
+            Initialize (AllocateSlab (width (), height (), depth ()), x, y, z, clear_data);
+            return;
+        }
+        Initialize (pool.Acquire (), x, y, z, clear_data);
     }
 
     ~Volume () {
-        delete[] data_;
-        delete[] layer_x_block_count_;
-        delete[] layer_y_block_count_;
-        delete[] layer_z_block_count_;
+        if (pool_ != NULL) {
+            pool_->Release (slab_);
+        }else {
+            FreeVolumeSlab (slab_);
+        }
+    }
+
+    /*
+     * Takes the volume and its memory from 'pool', without any allocation once the pool has
+     * a free slab. Returns NULL if the system is out of memory. Free the volume with Destroy.
+     */
+    static Volume* Create (VolumePool<Type>& pool, const GLuint x, const GLuint y, const GLuint z, const bool clear_data) {
+        /* Compile-time sizes that don't match the pool get memory of their own. */
+        if ((kWidth != kRuntimeSize && kWidth != pool.width ()) || (kHeight != kRuntimeSize && kHeight != pool.height ()) ||
+                (kDepth != kRuntimeSize && kDepth != pool.depth ())) {
+            return new Volume (pool, x, y, z, clear_data);
+        }
+
+        static_assert (sizeof (Volume) == sizeof (Volume<Type, kRuntimeSize, kRuntimeSize, kRuntimeSize>),
+            "The header of a pool slab only fits volumes of the size of runtime sized ones.");
+
+        void* slab = pool.Acquire ();
+        if (slab == NULL) {
+            return NULL;
+        }
+        return new ((u8*) slab - pool.header_size ()) Volume (pool, slab, x, y, z, clear_data);
+    }
+
+    static void Destroy (Volume* volume) {
+        if (volume == NULL) return;
+
+        if (volume->placed_) {
+            /* The destructor hands the memory of the volume back to the pool. */
+            volume->~Volume ();
+        }else {
+            delete volume;
+        }
     }
 
 
     inline const size_t GetVoxelIndex (const VoxPos x, const VoxPos y, const VoxPos z) const {
-        return y * kLayerSize + z * kWidth + x;
+        return y * area () + z * width () + x;
+    }
+
+    inline void GetVoxelPosition (const size_t index, VoxPos& x, VoxPos& y, VoxPos& z) const {
+        y = (VoxPos) (index / area ());
+        z = (VoxPos) ((index / width ()) % depth ());
+        x = (VoxPos) (index % width ());
     }
 
     inline bool PositionOutOfBounds (VoxPos x, VoxPos y, VoxPos z) const {
-        return x < 0 || x >= kWidth || y < 0 || y >= kHeight || z < 0 || z >= kDepth;
+        return x < 0 || x >= width () || y < 0 || y >= height () || z < 0 || z >= depth ();
     }
     
     inline Type GetVoxel (const VoxPos x, const VoxPos y, const VoxPos z, const bool check_bounds = false) const {
@@ -74,7 +255,8 @@ public:
     }
 
     void SetVoxel (const VoxPos x, const VoxPos y, const VoxPos z, const Type voxel) {
-        Type& voxel_at_pos = data_[GetVoxelIndex (x, y, z)];
+        const size_t index = GetVoxelIndex (x, y, z);
+        Type& voxel_at_pos = data_[index];
         if (voxel == 0) {
             if (voxel_at_pos == 0) {
                 return;
@@ -82,18 +264,22 @@ public:
                 layer_x_block_count_[x] -= 1;
                 layer_y_block_count_[y] -= 1;
                 layer_z_block_count_[z] -= 1;
+                OpenVisibility (index);
             }
         }else { /* voxel != 0 */
             if (voxel_at_pos == 0) {
                 layer_x_block_count_[x] += 1;
                 layer_y_block_count_[y] += 1;
                 layer_z_block_count_[z] += 1;
+                CloseVisibility ();
             }
         }
         voxel_at_pos = voxel;
     }
 
     void SetVoxelsInRegion (const Region& region, const Type voxel) {
+        VOX_TRACE_ZONE ("Volume::SetVoxelsInRegion");
+
         const VoxPos x_end = region.x_end ();
         const VoxPos y_end = region.y_end ();
         const VoxPos z_end = region.z_end ();
@@ -106,6 +292,44 @@ public:
         }
     }
 
+    /*
+     * Overwrites the column at (x, z) with 'column', which holds height () voxels from bottom to top.
+     * The x and z layer counts are updated once for the whole column instead of per voxel.
+     */
+    void SetColumn (const VoxPos x, const VoxPos z, const Type* column) {
+        VOX_TRACE_BEGIN ("Volume::SetColumn");
+
+        VoxArea added = 0;
+        VoxArea removed = 0;
+
+        size_t index = GetVoxelIndex (x, 0, z);
+        const VoxPos column_height = height ();
+        const VoxArea layer_size = area ();
+        for (VoxPos y = 0; y < column_height; ++y, index += layer_size) {
+            const Type voxel = column[y];
+            Type& voxel_at_pos = data_[index];
+            if (voxel == 0) {
+                if (voxel_at_pos != 0) {
+                    layer_y_block_count_[y] -= 1;
+                    ++removed;
+                    OpenVisibility (index);
+                }
+            }else { /* voxel != 0 */
+                if (voxel_at_pos == 0) {
+                    layer_y_block_count_[y] += 1;
+                    ++added;
+                    CloseVisibility ();
+                }
+            }
+            voxel_at_pos = voxel;
+        }
+
+        layer_x_block_count_[x] += added - removed;
+        layer_z_block_count_[z] += added - removed;
+
+        VOX_TRACE_END ("Volume::SetColumn");
+    }
+
     inline bool IsLayerXEmpty (const VoxPos x) const {
         return layer_x_block_count_[x] == 0;
     }
@@ -123,13 +347,25 @@ public:
     inline GLuint x () const { return x_; }
     inline GLuint y () const { return y_; }
     inline GLuint z () const { return z_; }
+
+    inline VoxVisibility visibility () const { return visibility_; }
+    inline bool visibility_dirty () const { return visibility_dirty_; }
+    inline u32 visibility_pending_count () const { return visibility_pending_count_; }
+    inline const u32* visibility_pending () const { return visibility_pending_; }
+
+    inline void set_visibility (const VoxVisibility visibility) {
+        visibility_ = visibility;
+        visibility_dirty_ = false;
+        visibility_pending_count_ = 0;
+    }
     
-    inline static const size_t data_size () { return kVolumeSize * sizeof (Type); } 
-    inline static const VoxSize width () { return kWidth; }
-    inline static const VoxSize height () { return kHeight; }
-    inline static const VoxSize depth () { return kDepth; }
-    inline static const VoxArea area () { return kLayerSize; }
-    inline static const VoxVolume volume () { return kVolumeSize; }
+    inline VoxSize width () const { return (kWidth != kRuntimeSize) ? kWidth : width_; }
+    inline VoxSize height () const { return (kHeight != kRuntimeSize) ? kHeight : height_; }
+    inline VoxSize depth () const { return (kDepth != kRuntimeSize) ? kDepth : depth_; }
+    inline VoxArea area () const { return (VoxArea) width () * depth (); }
+    inline VoxVolume volume () const { return area () * height (); }
+    inline size_t data_size () const { return volume () * sizeof (Type); }
+    inline VolumePool<Type>* pool () const { return pool_; }
 };
 
 }
@@ -0,0 +1,179 @@
+#ifndef VOX_VOLUMEPOOL_H_
+#define VOX_VOLUMEPOOL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+#include <vox/vox.h>
+#include <vox/util/RawList.h>
+
+
+namespace vox {
+
+template<typename Type, VoxSize kWidth, VoxSize kHeight, VoxSize kDepth>
+class Volume;
+
+static const size_t kCacheLineSize = 64;
+
+inline size_t AlignToCacheLine (const size_t size) {
+    return (size + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+}
+
+inline void* AllocateVolumeSlab (const size_t size) {
+    #ifdef _MSC_VER
+    void* slab = _aligned_malloc (size, kCacheLineSize);
+    #else
+    void* slab = NULL;
+    if (posix_memalign (&slab, kCacheLineSize, size) != 0) {
+        slab = NULL;
+    }
+    #endif
+
+    if (slab == NULL) {
+        printf ("Error: Could not allocate a volume slab of '%llu' bytes!\n", (unsigned long long) size);
+    }
+    return slab;
+}
+
+inline void FreeVolumeSlab (void* slab) {
+    #ifdef _MSC_VER
+    _aligned_free (slab);
+    #else
+    free (slab);
+    #endif
+}
+
+/*
+ * Where the parts of a volume live in its slab: the voxels first, then the x, y and z layer counts.
+ * Both the voxels and the slab size are padded to whole cache lines.
+ */
+struct VolumeSlabLayout {
+    size_t layer_x_offset;
+    size_t layer_y_offset;
+    size_t layer_z_offset;
+    size_t size;
+
+    VolumeSlabLayout (const VoxSize width, const VoxSize height, const VoxSize depth, const size_t voxel_size) {
+        layer_x_offset = AlignToCacheLine ((size_t) width * height * depth * voxel_size);
+        layer_y_offset = layer_x_offset + width * sizeof (VoxArea);
+        layer_z_offset = layer_y_offset + height * sizeof (VoxArea);
+        size = AlignToCacheLine (layer_z_offset + depth * sizeof (VoxArea));
+    }
+};
+
+/*
+ * Recycles the storage of volumes of one size, so that streaming volumes in and out
+ * doesn't go through the system allocator. Slabs are allocated in blocks, the first one
+ * holding 'initial_slab_count' slabs and every later one 'slabs_per_block' slabs.
+ * Slabs are only returned to the system when the pool is destroyed, after all of its volumes.
+ *
+ * Every slab has room for the Volume object in front of it, so volumes made with
+ * Volume::Create are recycled as a whole and need no allocation at all.
+ *
+ * The pool is not thread-safe.
+ */
+template <typename Type>
+class VolumePool {
+private:
+    VoxSize width_;
+    VoxSize height_;
+    VoxSize depth_;
+    size_t header_size_;
+    size_t slab_size_;
+    u32 slabs_per_block_;
+
+    RawList<void*> blocks_;
+    u32 block_count_;
+
+    RawList<void*> free_slabs_;
+    u32 free_count_;
+    u32 slab_count_;
+
+    void AllocateBlock (const u32 slab_count) {
+        u8* block = (u8*) AllocateVolumeSlab (slab_count * (header_size_ + slab_size_));
+        if (block == NULL) {
+            return;
+        }
+
+        if (block_count_ >= blocks_.size ()) {
+            blocks_.Resize (block_count_ + 1);
+        }
+        blocks_[block_count_++] = block;
+
+        /* Make room for every slab up front, so Release never allocates. */
+        slab_count_ += slab_count;
+        if (slab_count_ > free_slabs_.size ()) {
+            free_slabs_.Resize (slab_count_);
+        }
+        for (u32 i = 0; i < slab_count; ++i) {
+            free_slabs_[free_count_++] = block + i * (header_size_ + slab_size_) + header_size_;
+        }
+    }
+
+
+public:
+    VolumePool (const VoxSize width, const VoxSize height, const VoxSize depth, const u32 initial_slab_count, const u32 slabs_per_block = 16)
+            : blocks_ (4), free_slabs_ (initial_slab_count > 0 ? initial_slab_count : 1) {
+        width_ = width;
+        height_ = height;
+        depth_ = depth;
+        slab_size_ = VolumeSlabLayout (width, height, depth, sizeof (Type)).size;
+
+        /* Volumes of one voxel type have the same size, whatever their dimensions. */
+        header_size_ = AlignToCacheLine (sizeof (Volume<Type, kRuntimeSize, kRuntimeSize, kRuntimeSize>));
+        slabs_per_block_ = (slabs_per_block > 0) ? slabs_per_block : 1;
+
+        block_count_ = 0;
+        free_count_ = 0;
+        slab_count_ = 0;
+
+        if (initial_slab_count > 0) {
+            AllocateBlock (initial_slab_count);
+        }
+    }
+
+    ~VolumePool () {
+        if (free_count_ != slab_count_) {
+            printf ("Error: VolumePool destroyed while %u volumes still use it!\n", slab_count_ - free_count_);
+        }
+        for (u32 i = 0; i < block_count_; ++i) {
+            FreeVolumeSlab (blocks_[i]);
+        }
+    }
+
+    /* Returns a cache-aligned slab of slab_size () bytes, or NULL if the system is out of memory. */
+    void* Acquire () {
+        if (free_count_ == 0) {
+            AllocateBlock (slabs_per_block_);
+            if (free_count_ == 0) {
+                return NULL;
+            }
+        }
+        return free_slabs_[--free_count_];
+    }
+
+    void Release (void* slab) {
+        free_slabs_[free_count_++] = slab;
+    }
+
+    inline VoxSize width () const { return width_; }
+    inline VoxSize height () const { return height_; }
+    inline VoxSize depth () const { return depth_; }
+    inline size_t slab_size () const { return slab_size_; }
+    /* The room for the Volume object right in front of every slab. */
+    inline size_t header_size () const { return header_size_; }
+
+    /* Every block is one system allocation. */
+    inline u32 block_count () const { return block_count_; }
+    inline u32 slab_count () const { return slab_count_; }
+    inline u32 free_count () const { return free_count_; }
+};
+
+}
+
+
+#endif  /* VOX_VOLUMEPOOL_H_ */
@@ -5,6 +5,7 @@
 
 #include <vox/Volume.h>
 #include <vox/util/RawList.h>
+#include <vox/util/Trace.h>
 
 
 namespace vox {
@@ -12,16 +13,21 @@ namespace vox {
 template <typename VoxelType, typename VolumeType, typename IndexType = GLuint, VoxelType kEmptyCubeIndex = 0>
 class CubeGenerator {
 public:
+    /*
+     * 'shade' holds the baked lighting of the vertex as an integer:
+     * Bits 0-1 are the ambient occlusion level (0 is fully occluded, 3 is open),
+     * bits 2-5 the block light and bits 6-9 the sky light (both 0 to 15).
+     */
     struct Vertex {
         GLfloat x, y, z;
         GLfloat normal_x, normal_y, normal_z;
         GLfloat texture_id;
-        GLfloat padding;
+        GLfloat shade;
 
         Vertex (VolumeType& volume, const float kCubeSize,
                 GLfloat x, GLfloat y, GLfloat z,
                 GLfloat normal_x, GLfloat normal_y, GLfloat normal_z,
-                GLfloat texture_id) {
+                GLfloat texture_id, GLfloat shade) {
             this->x = x + volume.x () * kCubeSize;
             this->y = y + volume.y () * kCubeSize;
             this->z = z + volume.z () * kCubeSize;
@@ -29,10 +35,34 @@ public:
             this->normal_y = normal_y;
             this->normal_z = normal_z;
             this->texture_id = texture_id;
+            this->shade = shade;
         }
 
         void Print () {
-            printf ("(%f, %f, %f) (%f, %f, %f) : %f\n", x, y, z, normal_x, normal_y, normal_z, texture_id);
+            printf ("(%f, %f, %f) (%f, %f, %f) : %f, %f\n", x, y, z, normal_x, normal_y, normal_z, texture_id, shade);
+        }
+    };
+
+    /*
+     * The volumes next to the one being generated and their light, indexed by kFace* (see Visibility.h).
+     * Faces on the border of the volume are shaded with them: a missing volume leaves the faces open
+     * and lit by the sky, a missing light lights them by the sky. Neighbours have the size of the volume.
+     *
+     * Ambient occlusion along the edges of the volume also samples the volumes that only share an edge
+     * or a corner with it, indexed by their direction on each axis plus one. The entries of the faces
+     * and of the volume itself are never read. Missing volumes count as air.
+     */
+    struct Border {
+        const VolumeType* volumes[kFaceCount];
+        const u8* light[kFaceCount];
+        const VolumeType* diagonals[3][3][3];
+
+        Border () {
+            for (int i = 0; i < kFaceCount; ++i) {
+                volumes[i] = NULL;
+                light[i] = NULL;
+            }
+            memset (diagonals, 0, sizeof (diagonals));
         }
     };
 
@@ -43,29 +73,51 @@ private:
 
     /*
      * A bitmask for the cube merger to identify already merged quads.
-     * Should be allocated on the stack!
+     * The flags live in the scratch memory of the generator. A size of kRuntimeSize
+     * is taken from the constructor instead.
+     *
+     * The layer also reads the voxels of the volume. With the sizes known at compile time, it
+     * indexes them with constants even when the volume itself is sized at runtime.
      */
-    template<int kLayerType, VoxSize kWidth, VoxSize kHeight>
+    template<int kLayerType, VoxSize kAxisSize, VoxSize kWidth, VoxSize kHeight>
     class Layer {
     public:
-        static const VoxSize kWidth = kWidth;
-        static const VoxSize kHeight = kHeight;
-
         typedef bool T;
 
-        inline static size_t GetIndex (VoxPos x, VoxPos y) {
-            return y * kHeight + x;
+    private:
+        T* flags_;
+        VoxSize width_;
+        VoxSize height_;
+
+    public:
+        Layer (T* flags, const VoxSize width, const VoxSize height) {
+            flags_ = flags;
+            width_ = width;
+            height_ = height;
+        }
+
+        inline VoxSize width () const { return (kWidth != kRuntimeSize) ? kWidth : width_; }
+        inline VoxSize height () const { return (kHeight != kRuntimeSize) ? kHeight : height_; }
+
+        inline size_t GetIndex (VoxPos x, VoxPos y) const {
+            return y * width () + x;
+        }
+
+        inline bool Get (VoxPos x, VoxPos y) const {
+            return flags_[GetIndex (x, y)];
         }
 
-        inline static bool Get (T* layer, VoxPos x, VoxPos y) {
-            return layer[GetIndex (x, y)];
+        inline void Set (VoxPos x, VoxPos y, bool flag) {
+            flags_[GetIndex (x, y)] = flag;
         }
 
-        inline static void Set (T* layer, VoxPos x, VoxPos y, bool flag) {
-            layer[GetIndex (x, y)] = flag;
+        /* Sets 'count' flags starting at (x, y). */
+        inline void Mark (VoxPos x, VoxPos y, VoxSize count) {
+            memset (flags_ + GetIndex (x, y), 0x01, count * sizeof (T));
         }
 
-        inline static void TransformIndex (VoxPos lx, VoxPos ly, VoxPos axis_coordinate, VoxPos& x, VoxPos& y, VoxPos& z) {
+        template<typename Coordinate>
+        inline static void TransformIndex (Coordinate lx, Coordinate ly, Coordinate axis_coordinate, Coordinate& x, Coordinate& y, Coordinate& z) {
             switch (kLayerType) {
             case kLayerTypeX:
                 x = axis_coordinate;
@@ -85,16 +137,55 @@ private:
             }
         }
 
-        inline static VoxelType GetVoxel (VolumeType& volume, VoxPos lx, VoxPos ly, VoxPos axis_coordinate) {
+        /* The size of the volume, from the sizes of the layer where they are known. */
+        inline static VoxSize GetVolumeWidth (const VolumeType& volume) {
+            const VoxSize width = (kLayerType == kLayerTypeX) ? kAxisSize : kWidth;
+            return (width != kRuntimeSize) ? width : volume.width ();
+        }
+
+        inline static VoxSize GetVolumeHeight (const VolumeType& volume) {
+            const VoxSize height = (kLayerType == kLayerTypeY) ? kAxisSize : kHeight;
+            return (height != kRuntimeSize) ? height : volume.height ();
+        }
+
+        inline static VoxSize GetVolumeDepth (const VolumeType& volume) {
+            const VoxSize depth = (kLayerType == kLayerTypeX) ? kWidth : ((kLayerType == kLayerTypeY) ? kHeight : kAxisSize);
+            return (depth != kRuntimeSize) ? depth : volume.depth ();
+        }
+
+        /* See Volume::GetVoxelIndex. */
+        inline static size_t GetVoxelIndex (const VolumeType& volume, const VoxPos x, const VoxPos y, const VoxPos z) {
+            return ((size_t) y * GetVolumeDepth (volume) + z) * GetVolumeWidth (volume) + x;
+        }
+
+        inline static VoxelType GetVoxel (const VolumeType& volume, VoxPos lx, VoxPos ly, VoxPos axis_coordinate, const bool check_bounds = false) {
             VoxPos x, y, z;
             TransformIndex (lx, ly, axis_coordinate, x, y, z);
-            return volume.GetVoxel (x, y, z);
+            if (check_bounds) {
+                if (x >= GetVolumeWidth (volume) || y >= GetVolumeHeight (volume) || z >= GetVolumeDepth (volume)) {
+                    return 0;
+                }
+            }
+            return volume.data ()[GetVoxelIndex (volume, x, y, z)];
+        }
+
+        /* The face of the volume (see Visibility.h) that faces of this layer in 'direction' lie on at the border. */
+        inline static int GetFace (const int direction) {
+            return kLayerType * 2 + ((direction > 0) ? 1 : 0);
+        }
+
+        inline static VoxSize GetAxisSize (const VolumeType& volume) {
+            switch (kLayerType) {
+            case kLayerTypeX: return GetVolumeWidth (volume);
+            case kLayerTypeY: return GetVolumeHeight (volume);
+            }
+            return GetVolumeDepth (volume);
         }
 
-        static void Print (T* layer) {
-            for (VoxPos ly = 0; ly < kHeight; ++ly) {
-                for (int lx = 0; lx < kWidth; ++lx) {
-                    printf ("%u ", Get (layer, lx, ly));
+        void Print () const {
+            for (VoxPos ly = 0; ly < height (); ++ly) {
+                for (int lx = 0; lx < width (); ++lx) {
+                    printf ("%u ", Get (lx, ly));
                 }
                 printf ("\n");
             }
@@ -116,9 +207,86 @@ private:
     u32 expected_vertex_count_;
     bool update_;
 
+    bool ambient_occlusion_;
+
     RawList<Vertex> vertices_;
     RawList<IndexType> indices_;
 
+    /*
+     * The shade of a face cell packs the ambient occlusion of its four corners into bits 0-7,
+     * two bits per corner in the order (x, y), (x + 1, y), (x, y + 1), (x + 1, y + 1) of the layer,
+     * and the light of the voxel in front of the face into bits 8-15 (see LightVolume).
+     * Only cells with the same shade are merged.
+     */
+    typedef u16 Shade;
+
+    static const Shade kShadeOpen = 0x00FF;
+    static const Shade kShadeSkyLight = 0xF000;
+
+    /* Scratch memory for the flags and shades of one layer, sized to the largest layer seen. */
+    RawList<bool> layer_flags_;
+    RawList<Shade> layer_shades_;
+
+    template<typename LayerType>
+    inline static Shade GetCornerOcclusion (const VolumeType& volume, const VoxPos lx, const VoxPos ly, const VoxPos axis_neighbour, const int dx, const int dy) {
+        /* Out of bounds coordinates wrap around and are treated as air. */
+        const int side_x = LayerType::GetVoxel (volume, (VoxPos) (lx + dx), ly, axis_neighbour, true) != kEmptyCubeIndex;
+        const int side_y = LayerType::GetVoxel (volume, lx, (VoxPos) (ly + dy), axis_neighbour, true) != kEmptyCubeIndex;
+        const int corner = LayerType::GetVoxel (volume, (VoxPos) (lx + dx), (VoxPos) (ly + dy), axis_neighbour, true) != kEmptyCubeIndex;
+        if (side_x && side_y) {
+            return 0;
+        }
+        return (Shade) (3 - (side_x + side_y + corner));
+    }
+
+    /* Whether the voxel at (x, y, z) of 'volume' is solid, where coordinates outside of it lead into the volumes of 'border'. */
+    inline static bool IsSolid (const VolumeType& volume, const Border& border, int x, int y, int z) {
+        const int width = volume.width ();
+        const int height = volume.height ();
+        const int depth = volume.depth ();
+        const int dx = (x < 0) ? -1 : ((x >= width) ? 1 : 0);
+        const int dy = (y < 0) ? -1 : ((y >= height) ? 1 : 0);
+        const int dz = (z < 0) ? -1 : ((z >= depth) ? 1 : 0);
+
+        const VolumeType* source = &volume;
+        if (dx != 0 || dy != 0 || dz != 0) {
+            if ((dx != 0) + (dy != 0) + (dz != 0) == 1) {
+                const int face = (dx != 0) ? kFaceXNegative + (dx > 0) : ((dy != 0) ? kFaceYNegative + (dy > 0) : kFaceZNegative + (dz > 0));
+                source = border.volumes[face];
+            }else {
+                source = border.diagonals[dx + 1][dy + 1][dz + 1];
+            }
+            if (source == NULL) {
+                return false;
+            }
+
+            x += (dx < 0) ? source->width () : ((dx > 0) ? -width : 0);
+            y += (dy < 0) ? source->height () : ((dy > 0) ? -height : 0);
+            z += (dz < 0) ? source->depth () : ((dz > 0) ? -depth : 0);
+        }
+        return source->GetVoxel ((VoxPos) x, (VoxPos) y, (VoxPos) z) != kEmptyCubeIndex;
+    }
+
+    /* Like GetCornerOcclusion, but reads the samples beyond the edges of the layer from 'border'. */
+    template<typename LayerType>
+    inline static Shade GetBorderCornerOcclusion (const VolumeType& volume, const Border& border, const int lx, const int ly, const int axis_neighbour, const int dx, const int dy) {
+        int x, y, z;
+        LayerType::TransformIndex (lx + dx, ly, axis_neighbour, x, y, z);
+        const int side_x = IsSolid (volume, border, x, y, z);
+        LayerType::TransformIndex (lx, ly + dy, axis_neighbour, x, y, z);
+        const int side_y = IsSolid (volume, border, x, y, z);
+        LayerType::TransformIndex (lx + dx, ly + dy, axis_neighbour, x, y, z);
+        const int corner = IsSolid (volume, border, x, y, z);
+        if (side_x && side_y) {
+            return 0;
+        }
+        return (Shade) (3 - (side_x + side_y + corner));
+    }
+
+    inline static GLfloat GetVertexShade (const Shade shade, const int corner) {
+        return (GLfloat) (((shade >> (corner * 2)) & 0x03) | ((shade >> 8) << 2));
+    }
+
     template<typename T>
     inline void ReserveCapacity (RawList<T>& list, size_t needed) {
         if (needed > list.size ()) {
@@ -126,24 +294,123 @@ private:
         }
     }
 
+    /* Shades the faces of 'layer' by the layer at 'axis_neighbour' of 'volume' and its light, if any. */
     template<typename LayerType>
-    inline void SetLayerFlags (VolumeType& volume, typename LayerType::T* layer, const VoxPos axis_coordinate, const VoxSize axis_size, const int direction) {
-        for (VoxPos ly = 0; ly < LayerType::kHeight; ++ly) {
-            for (VoxPos lx = 0; lx < LayerType::kWidth; ++lx) {
+    inline void ShadeLayer (const VolumeType& volume, const u8* light, const LayerType& layer, Shade* shades, const VoxPos axis_neighbour) {
+        const VoxSize layer_width = layer.width ();
+        const VoxSize layer_height = layer.height ();
+        for (VoxPos ly = 0; ly < layer_height; ++ly) {
+            for (VoxPos lx = 0; lx < layer_width; ++lx) {
+                const size_t index = layer.GetIndex (lx, ly);
+                if (layer.Get (lx, ly)) {
+                    shades[index] = kShadeOpen | kShadeSkyLight;
+                    continue;
+                }
+
+                Shade shade = kShadeOpen;
+                if (ambient_occlusion_) {
+                    shade = GetCornerOcclusion<LayerType> (volume, lx, ly, axis_neighbour, -1, -1) |
+                        (GetCornerOcclusion<LayerType> (volume, lx, ly, axis_neighbour, 1, -1) << 2) |
+                        (GetCornerOcclusion<LayerType> (volume, lx, ly, axis_neighbour, -1, 1) << 4) |
+                        (GetCornerOcclusion<LayerType> (volume, lx, ly, axis_neighbour, 1, 1) << 6);
+                }
+
+                if (light != NULL) {
+                    VoxPos x, y, z;
+                    LayerType::TransformIndex (lx, ly, axis_neighbour, x, y, z);
+                    shade |= light[LayerType::GetVoxelIndex (volume, x, y, z)] << 8;
+                }else {
+                    shade |= kShadeSkyLight;
+                }
+
+                shades[index] = shade;
+            }
+        }
+    }
+
+    /*
+     * The corners of the cells on the edges of 'layer' touch the neighbouring volumes, so their ambient occlusion
+     * is sampled again with 'border'. 'axis_neighbour' is relative to 'volume' and may lie outside of it.
+     */
+    template<typename LayerType>
+    inline static void ShadeLayerEdges (const VolumeType& volume, const Border& border, const LayerType& layer, Shade* shades, const int axis_neighbour) {
+        const int layer_width = layer.width ();
+        const int layer_height = layer.height ();
+        for (int ly = 0; ly < layer_height; ++ly) {
+            /* Rows in between only have their first and last cell on the edge. */
+            const int step = (ly == 0 || ly == layer_height - 1) ? 1 : max (layer_width - 1, 1);
+            for (int lx = 0; lx < layer_width; lx += step) {
+                if (layer.Get ((VoxPos) lx, (VoxPos) ly)) {
+                    continue;
+                }
+
+                Shade& shade = shades[layer.GetIndex ((VoxPos) lx, (VoxPos) ly)];
+                for (int corner = 0; corner < 4; ++corner) {
+                    const int dx = (corner & 1) ? 1 : -1;
+                    const int dy = (corner & 2) ? 1 : -1;
+
+                    /* Corners whose samples all lie within the layer are already right. */
+                    if (lx + dx >= 0 && lx + dx < layer_width && ly + dy >= 0 && ly + dy < layer_height) {
+                        continue;
+                    }
+
+                    const int shift = corner * 2;
+                    shade = (Shade) ((shade & ~(0x03 << shift)) | (GetBorderCornerOcclusion<LayerType> (volume, border, lx, ly, axis_neighbour, dx, dy) << shift));
+                }
+            }
+        }
+    }
+
+    template<typename LayerType>
+    inline void SetLayerShades (const VolumeType& volume, const u8* light, const Border* border, const LayerType& layer, Shade* shades,
+                                const VoxPos axis_coordinate, const VoxSize axis_size, const int direction) {
+        const VoxPos axis_neighbour = axis_coordinate + direction;
+        if (axis_neighbour < axis_size) {
+            ShadeLayer (volume, light, layer, shades, axis_neighbour);
+            if (ambient_occlusion_ && border != NULL) {
+                ShadeLayerEdges (volume, *border, layer, shades, axis_neighbour);
+            }
+            return;
+        }
+
+        /* Faces on the border of the volume look into the layer of the neighbouring volume that touches it. */
+        const int face = LayerType::GetFace (direction);
+        const VolumeType* neighbour = (border != NULL) ? border->volumes[face] : NULL;
+        if (neighbour != NULL) {
+            ShadeLayer (*neighbour, border->light[face], layer, shades, (direction > 0) ? 0 : LayerType::GetAxisSize (*neighbour) - 1);
+            if (ambient_occlusion_) {
+                ShadeLayerEdges (volume, *border, layer, shades, (int) axis_coordinate + direction);
+            }
+            return;
+        }
+
+        /* Without a neighbour the faces see neither occluders nor light, so they are open and lit by the sky. */
+        const size_t layer_size = (size_t) layer.width () * layer.height ();
+        for (size_t i = 0; i < layer_size; ++i) {
+            shades[i] = kShadeOpen | kShadeSkyLight;
+        }
+    }
+
+    template<typename LayerType>
+    inline void SetLayerFlags (VolumeType& volume, LayerType& layer, const VoxPos axis_coordinate, const VoxSize axis_size, const int direction) {
+        const VoxSize layer_width = layer.width ();
+        const VoxSize layer_height = layer.height ();
+        for (VoxPos ly = 0; ly < layer_height; ++ly) {
+            for (VoxPos lx = 0; lx < layer_width; ++lx) {
                 VoxelType voxel = LayerType::GetVoxel (volume, lx, ly, axis_coordinate);
 
                 /* Air voxels can be ignored. */
                 if (voxel == kEmptyCubeIndex) {
-                    LayerType::Set (layer, lx, ly, true);
+                    layer.Set (lx, ly, true);
                     continue;
                 }
 
                 /* Cube in front/back, quad invalid. */
                 const VoxPos axis_neighbour = axis_coordinate + direction;
                 if (axis_neighbour < axis_size && LayerType::GetVoxel (volume, lx, ly, axis_neighbour) != kEmptyCubeIndex) {
-                    LayerType::Set (layer, lx, ly, true);
+                    layer.Set (lx, ly, true);
                 }else { /* Clear. */
-                    LayerType::Set (layer, lx, ly, false);
+                    layer.Set (lx, ly, false);
                 }
             }
         }
@@ -155,6 +422,7 @@ public:
         vertices_generated_ = 0; /* The maximum possible face count. */
         runs_ = 0;
         update_ = false;
+        ambient_occlusion_ = false;
     }
 
     ~CubeGenerator () {
@@ -196,10 +464,38 @@ public:
     static const int kMergeAreaY = 2;
     static const int kMergeAreaZ = 3;
 
-    template<int kMergeType, int layer_type, VoxSize axis_size, VoxSize layer_x_size, VoxSize layer_y_size>
+    /*
+     * Sizes of kRuntimeSize are taken from the arguments of Do instead. Every size known at compile time
+     * lets the compiler unroll and strength-reduce the loops over the layer.
+     */
+    template<int kMergeType, int layer_type, VoxSize kAxisSize, VoxSize kLayerXSize, VoxSize kLayerYSize>
     class MergeArea {
     public:
-        inline static void Do (CubeGenerator* gen, VolumeType& volume, float* voxel_texture_ids, const float kCubeSize) {
+        inline static const char* Name () {
+            switch (kMergeType) {
+            case kMergeAreaXPositive: return "MergeArea X+";
+            case kMergeAreaXNegative: return "MergeArea X-";
+            case kMergeAreaYPositive: return "MergeArea Y+";
+            case kMergeAreaYNegative: return "MergeArea Y-";
+            case kMergeAreaZPositive: return "MergeArea Z+";
+            case kMergeAreaZNegative: return "MergeArea Z-";
+            }
+            return "MergeArea";
+        }
+
+        /* Without ambient occlusion and light every face has the same shade, so kShaded skips shading altogether. */
+        template<bool kShaded>
+        inline static void Do (CubeGenerator* gen, VolumeType& volume, float* voxel_texture_ids, const float kCubeSize, const u8* light, const Border* border,
+                               const VoxSize runtime_axis_size, const VoxSize runtime_layer_x_size, const VoxSize runtime_layer_y_size) {
+            VOX_TRACE_TOTAL (layer_time);
+
+            typedef Layer<layer_type, kAxisSize, kLayerXSize, kLayerYSize> LayerType;
+            const VoxSize axis_size = (kAxisSize != kRuntimeSize) ? kAxisSize : runtime_axis_size;
+            LayerType layer (gen->layer_flags_.data (), runtime_layer_x_size, runtime_layer_y_size);
+            Shade* shades = gen->layer_shades_.data ();
+            const VoxSize layer_width = layer.width ();
+            const VoxSize layer_height = layer.height ();
+
             const int direction = (kMergeType > 0) ? 1 : -1;
             const VoxPos axis_offset = (direction > 0) ? 1 : 0;
 
@@ -222,46 +518,53 @@ public:
                     break;
                 }
 
-                typedef Layer<layer_type, layer_x_size, layer_y_size> LayerType;
-                LayerType::T layer [layer_x_size * layer_y_size];
-
-                /* Fill layer information. */
-                gen->SetLayerFlags<LayerType> (volume, layer, axis_coord, axis_size, direction);
+                /* Fill layer information. Too frequent for a zone of its own, so only the total time is traced. */
+                {
+                    VOX_TRACE_ACCUMULATE (layer_time);
+                    gen->template SetLayerFlags<LayerType> (volume, layer, axis_coord, axis_size, direction);
+                    if (kShaded) {
+                        gen->template SetLayerShades<LayerType> (volume, light, border, layer, shades, axis_coord, axis_size, direction);
+                    }
+                }
 
                 /* if (kMergeType == kMergeAreaYPositive) {
                     printf ("Layer Flags: %u\n", axis_coord);
-                    LayerType::Print (layer);
+                    layer.Print ();
                 } */
 
                 /* Generate faces. */
-                for (VoxPos ly = 0; ly < LayerType::kHeight; ++ly) {
-                    for (VoxPos lx = 0; lx < LayerType::kWidth; ) {
-                        if (LayerType::Get (layer, lx, ly)) {
+                for (VoxPos ly = 0; ly < layer_height; ++ly) {
+                    for (VoxPos lx = 0; lx < layer_width; ) {
+                        if (layer.Get (lx, ly)) {
                             ++lx;
                             continue;
                         }
 
                         const VoxelType voxel = LayerType::GetVoxel (volume, lx, ly, axis_coord);
+                        const Shade shade = kShaded ? shades[layer.GetIndex (lx, ly)] : (Shade) (kShadeOpen | kShadeSkyLight);
 
                         /* Get maximum adjacent layer_y. */
                         VoxPos ly_end = ly + 1;
-                        for (; ly_end < LayerType::kHeight; ++ly_end) {
-                            if (LayerType::Get (layer, lx, ly_end) ||
-                                LayerType::GetVoxel (volume, lx, ly_end, axis_coord) != voxel) break;
+                        for (; ly_end < layer_height; ++ly_end) {
+                            if (layer.Get (lx, ly_end) ||
+                                LayerType::GetVoxel (volume, lx, ly_end, axis_coord) != voxel ||
+                                (kShaded && shades[layer.GetIndex (lx, ly_end)] != shade)) break;
                         }
 
                         /* Get maximum adjacent layer_x. */
                         VoxPos lx_end = lx + 1;
-                        for (; lx_end < LayerType::kWidth; ++lx_end) {
-                            if (LayerType::Get (layer, lx_end, ly) ||
-                                LayerType::GetVoxel (volume, lx_end, ly, axis_coord) != voxel) break;
+                        for (; lx_end < layer_width; ++lx_end) {
+                            if (layer.Get (lx_end, ly) ||
+                                LayerType::GetVoxel (volume, lx_end, ly, axis_coord) != voxel ||
+                                (kShaded && shades[layer.GetIndex (lx_end, ly)] != shade)) break;
                         }
 
                         /* Check enclosed voxels on z axis. */
                         for (VoxPos slx = lx + 1; slx < lx_end; ++slx) {
                             for (VoxPos sly = ly + 1; sly < ly_end; ++sly) {
-                                if (LayerType::Get (layer, slx, sly) ||
-                                    LayerType::GetVoxel (volume, slx, sly, axis_coord) != voxel) {
+                                if (layer.Get (slx, sly) ||
+                                    LayerType::GetVoxel (volume, slx, sly, axis_coord) != voxel ||
+                                    (kShaded && shades[layer.GetIndex (slx, sly)] != shade)) {
                                     ly_end = sly;
                                     break;
                                 }
@@ -271,8 +574,9 @@ public:
                         /* Check enclosed voxels on x axis. */
                         for (VoxPos sly = ly + 1; sly < ly_end; ++sly) {
                             for (VoxPos slx = lx + 1; slx < lx_end; ++slx) {
-                                if (LayerType::Get (layer, slx, sly) ||
-                                    LayerType::GetVoxel (volume, slx, sly, axis_coord) != voxel) {
+                                if (layer.Get (slx, sly) ||
+                                    LayerType::GetVoxel (volume, slx, sly, axis_coord) != voxel ||
+                                    (kShaded && shades[layer.GetIndex (slx, sly)] != shade)) {
                                     lx_end = slx;
                                     break;
                                 }
@@ -295,62 +599,73 @@ public:
                         const GLfloat face_y_end = face_y + height * kCubeSize;
                         const GLfloat face_axis_coord = (axis_coord + axis_offset) * kCubeSize;
 
+                        /* Vertex shades by layer corner. */
+                        const GLfloat shade_00 = GetVertexShade (shade, 0);
+                        const GLfloat shade_10 = GetVertexShade (shade, 1);
+                        const GLfloat shade_01 = GetVertexShade (shade, 2);
+                        const GLfloat shade_11 = GetVertexShade (shade, 3);
+
                         switch (kMergeType) {
                         case kMergeAreaXPositive: /* Right. */
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y, face_x,            1.0f, 0.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y_end, face_x,        1.0f, 0.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y_end, face_x_end,    1.0f, 0.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y, face_x_end,        1.0f, 0.0f, 0.0f, texture_id);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y, face_x,            1.0f, 0.0f, 0.0f, texture_id, shade_00);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y_end, face_x,        1.0f, 0.0f, 0.0f, texture_id, shade_01);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y_end, face_x_end,    1.0f, 0.0f, 0.0f, texture_id, shade_11);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y, face_x_end,        1.0f, 0.0f, 0.0f, texture_id, shade_10);
                             break;
                         case kMergeAreaXNegative: /* Left. */
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y, face_x,            -1.0f, 0.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y, face_x_end,        -1.0f, 0.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y_end, face_x_end,    -1.0f, 0.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y_end, face_x,        -1.0f, 0.0f, 0.0f, texture_id);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y, face_x,            -1.0f, 0.0f, 0.0f, texture_id, shade_00);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y, face_x_end,        -1.0f, 0.0f, 0.0f, texture_id, shade_10);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y_end, face_x_end,    -1.0f, 0.0f, 0.0f, texture_id, shade_11);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_axis_coord, face_y_end, face_x,        -1.0f, 0.0f, 0.0f, texture_id, shade_01);
                             break;
                         case kMergeAreaYPositive: /* Top. */
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_axis_coord, face_y,            0.0f, 1.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_axis_coord, face_y_end,        0.0f, 1.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_axis_coord, face_y_end,    0.0f, 1.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_axis_coord, face_y,        0.0f, 1.0f, 0.0f, texture_id);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_axis_coord, face_y,            0.0f, 1.0f, 0.0f, texture_id, shade_00);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_axis_coord, face_y_end,        0.0f, 1.0f, 0.0f, texture_id, shade_01);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_axis_coord, face_y_end,    0.0f, 1.0f, 0.0f, texture_id, shade_11);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_axis_coord, face_y,        0.0f, 1.0f, 0.0f, texture_id, shade_10);
                             break;
                         case kMergeAreaYNegative: /* Bottom. */
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_axis_coord, face_y,            0.0f, -1.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_axis_coord, face_y,        0.0f, -1.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_axis_coord, face_y_end,    0.0f, -1.0f, 0.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_axis_coord, face_y_end,        0.0f, -1.0f, 0.0f, texture_id);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_axis_coord, face_y,            0.0f, -1.0f, 0.0f, texture_id, shade_00);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_axis_coord, face_y,        0.0f, -1.0f, 0.0f, texture_id, shade_10);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_axis_coord, face_y_end,    0.0f, -1.0f, 0.0f, texture_id, shade_11);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_axis_coord, face_y_end,        0.0f, -1.0f, 0.0f, texture_id, shade_01);
                             break;
                         case kMergeAreaZPositive: /* Back. */
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_y, face_axis_coord,            0.0f, 0.0f, 1.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_y, face_axis_coord,        0.0f, 0.0f, 1.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_y_end, face_axis_coord,    0.0f, 0.0f, 1.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_y_end, face_axis_coord,        0.0f, 0.0f, 1.0f, texture_id);                            
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_y, face_axis_coord,            0.0f, 0.0f, 1.0f, texture_id, shade_00);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_y, face_axis_coord,        0.0f, 0.0f, 1.0f, texture_id, shade_10);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_y_end, face_axis_coord,    0.0f, 0.0f, 1.0f, texture_id, shade_11);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_y_end, face_axis_coord,        0.0f, 0.0f, 1.0f, texture_id, shade_01);
                             break;
                         case kMergeAreaZNegative: /* Front. */
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_y, face_axis_coord,            0.0f, 0.0f, -1.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_y_end, face_axis_coord,        0.0f, 0.0f, -1.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_y_end, face_axis_coord,    0.0f, 0.0f, -1.0f, texture_id);
-                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_y, face_axis_coord,        0.0f, 0.0f, -1.0f, texture_id);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_y, face_axis_coord,            0.0f, 0.0f, -1.0f, texture_id, shade_00);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x, face_y_end, face_axis_coord,        0.0f, 0.0f, -1.0f, texture_id, shade_01);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_y_end, face_axis_coord,    0.0f, 0.0f, -1.0f, texture_id, shade_11);
+                            gen->vertices ().Next () = Vertex (volume, kCubeSize, face_x_end, face_y, face_axis_coord,        0.0f, 0.0f, -1.0f, texture_id, shade_10);
                             break;
                         }
 
                         /* Add indices. */
-                        gen->ReserveCapacity (gen->indices (), gen->indices ().iterator () * 6);
+                        gen->ReserveCapacity (gen->indices (), gen->indices ().iterator () + 6);
 
-                        gen->indices ().Next () = vertex_0;
-                        gen->indices ().Next () = vertex_0 + 1;
-                        gen->indices ().Next () = vertex_0 + 2;
-                        gen->indices ().Next () = vertex_0 + 2;
-                        gen->indices ().Next () = vertex_0 + 3;
-                        gen->indices ().Next () = vertex_0;
+                        /* Vertex 0 and 2 are always at opposite layer corners (x, y) and (x_end, y_end).
+                            Split the quad along the brighter diagonal, so occlusion is interpolated symmetrically. */
+                        const IndexType diagonal = (GetVertexShade (shade, 0) + GetVertexShade (shade, 3) <
+                            GetVertexShade (shade, 1) + GetVertexShade (shade, 2)) ? 1 : 0;
+
+                        gen->indices ().Next () = vertex_0 + diagonal;
+                        gen->indices ().Next () = vertex_0 + diagonal + 1;
+                        gen->indices ().Next () = vertex_0 + diagonal + 2;
+                        gen->indices ().Next () = vertex_0 + diagonal + 2;
+                        gen->indices ().Next () = vertex_0 + (diagonal + 3) % 4;
+                        gen->indices ().Next () = vertex_0 + diagonal;
 
                         /* Mark layer. */
                         for (VoxPos mark_y = ly; mark_y < ly_end; ++mark_y) {
-                            memset (layer + LayerType::GetIndex (lx, mark_y), 0x01, width);
+                            layer.Mark (lx, mark_y, width);
                         }
 
                         /* Offset x and z. */
-                        if (lx == 0 && lx_end == LayerType::kWidth) { /* Rectangular full-fill. */
+                        if (lx == 0 && lx_end == layer_width) { /* Rectangular full-fill. */
                             ly = ly_end - 1; /* "-1" before "++ly". */
                             lx = 0;
                             break;
@@ -361,13 +676,84 @@ public:
                 }
 
                 /* if (kMergeType == kMergeAreaYPositive) {
-                    LayerType::Print (layer);
+                    layer.Print ();
                 } */
             }
+
+            VOX_TRACE_COUNTER ("Layer building (ns)", layer_time);
+        }
+    };
+
+    /* Traced from the outside, see VOX_TRACE_BEGIN. */
+    template<typename MergeAreaType>
+    inline void RunMergeArea (VolumeType& volume, float* voxel_texture_ids, const float kCubeSize, const u8* light, const Border* border,
+                              const VoxSize axis_size, const VoxSize layer_x_size, const VoxSize layer_y_size) {
+        VOX_TRACE_BEGIN (MergeAreaType::Name ());
+        if (ambient_occlusion_ || light != NULL || border != NULL) {
+            MergeAreaType::template Do<true> (this, volume, voxel_texture_ids, kCubeSize, light, border, axis_size, layer_x_size, layer_y_size);
+        }else {
+            MergeAreaType::template Do<false> (this, volume, voxel_texture_ids, kCubeSize, light, border, axis_size, layer_x_size, layer_y_size);
+        }
+        VOX_TRACE_END (MergeAreaType::Name ());
+    }
+
+    /* Runs all six merge passes with the sizes known at compile time, falling back to the volume for the others. */
+    template<VoxSize kWidth, VoxSize kHeight, VoxSize kDepth>
+    void MergeAreas (VolumeType& volume, float* voxel_texture_ids, const float kCubeSize, const u8* light, const Border* border) {
+        const VoxSize width = volume.width ();
+        const VoxSize height = volume.height ();
+        const VoxSize depth = volume.depth ();
+
+        // TODO(Marco): Wow, what a mess.
+        RunMergeArea<MergeArea<kMergeAreaXPositive, kLayerTypeX, kWidth, kDepth, kHeight> > (volume, voxel_texture_ids, kCubeSize, light, border, width, depth, height);
+        RunMergeArea<MergeArea<kMergeAreaXNegative, kLayerTypeX, kWidth, kDepth, kHeight> > (volume, voxel_texture_ids, kCubeSize, light, border, width, depth, height);
+        RunMergeArea<MergeArea<kMergeAreaYPositive, kLayerTypeY, kHeight, kWidth, kDepth> > (volume, voxel_texture_ids, kCubeSize, light, border, height, width, depth);
+        RunMergeArea<MergeArea<kMergeAreaYNegative, kLayerTypeY, kHeight, kWidth, kDepth> > (volume, voxel_texture_ids, kCubeSize, light, border, height, width, depth);
+        RunMergeArea<MergeArea<kMergeAreaZPositive, kLayerTypeZ, kDepth, kWidth, kHeight> > (volume, voxel_texture_ids, kCubeSize, light, border, depth, width, height);
+        RunMergeArea<MergeArea<kMergeAreaZNegative, kLayerTypeZ, kDepth, kWidth, kHeight> > (volume, voxel_texture_ids, kCubeSize, light, border, depth, width, height);
+    }
+
+    /* Volumes with a compile-time size merge with it. */
+    template<bool kRuntimeSized, int kDummy = 0>
+    class SizeDispatch {
+    public:
+        inline static void MergeAreas (CubeGenerator* gen, VolumeType& volume, float* voxel_texture_ids, const float kCubeSize, const u8* light, const Border* border) {
+            gen->template MergeAreas<VolumeType::kWidth, VolumeType::kHeight, VolumeType::kDepth> (volume, voxel_texture_ids, kCubeSize, light, border);
+        }
+    };
+
+    /* Runtime sized volumes of the common sizes get the same code as their compile-time counterparts. */
+    template<int kDummy>
+    class SizeDispatch<true, kDummy> {
+    private:
+        inline static bool Is (VolumeType& volume, const VoxSize width, const VoxSize height, const VoxSize depth) {
+            return volume.width () == width && volume.height () == height && volume.depth () == depth;
+        }
+
+    public:
+        inline static void MergeAreas (CubeGenerator* gen, VolumeType& volume, float* voxel_texture_ids, const float kCubeSize, const u8* light, const Border* border) {
+            if (Is (volume, 16, 16, 16)) {
+                gen->template MergeAreas<16, 16, 16> (volume, voxel_texture_ids, kCubeSize, light, border);
+            }else if (Is (volume, 32, 32, 32)) {
+                gen->template MergeAreas<32, 32, 32> (volume, voxel_texture_ids, kCubeSize, light, border);
+            }else if (Is (volume, 64, 64, 64)) {
+                gen->template MergeAreas<64, 64, 64> (volume, voxel_texture_ids, kCubeSize, light, border);
+            }else if (Is (volume, 16, 128, 16)) {
+                gen->template MergeAreas<16, 128, 16> (volume, voxel_texture_ids, kCubeSize, light, border);
+            }else {
+                gen->template MergeAreas<kRuntimeSize, kRuntimeSize, kRuntimeSize> (volume, voxel_texture_ids, kCubeSize, light, border);
+            }
         }
     };
 
-    void Generate (VolumeType& volume, float* voxel_texture_ids, const float kCubeSize) {
+    /*
+     * 'light' is optional and points to the light data of the volume (see LightVolume::data).
+     * Without it, every face is lit by the sky. 'border' is optional as well and shades the faces
+     * on the border of the volume (see Border).
+     */
+    void Generate (VolumeType& volume, float* voxel_texture_ids, const float kCubeSize, const u8* light = NULL, const Border* border = NULL) {
+        VOX_TRACE_ZONE ("CubeGenerator::Generate");
+
         /* Clear any data. */
         vertices_.ResetIterator ();
         indices_.ResetIterator ();
@@ -376,6 +762,8 @@ public:
             Don't consider the amount of layers here, 
             because that would make the average calculation worse. */
         if (update_) {
+            VOX_TRACE_ZONE ("CubeGenerator::ResizeBuffers");
+
             const size_t vertices_size = expected_vertex_count_ * 4;
             const size_t indices_size = expected_vertex_count_ * 6;
 
@@ -385,24 +773,32 @@ public:
             update_ = false;
         }
         
-        // TODO(Marco): Wow, what a mess.
-        MergeArea<kMergeAreaXPositive, kLayerTypeX, VolumeType::kWidth, VolumeType::kDepth, VolumeType::kHeight>::Do (this, volume, voxel_texture_ids, kCubeSize);
-        MergeArea<kMergeAreaXNegative, kLayerTypeX, VolumeType::kWidth, VolumeType::kDepth, VolumeType::kHeight>::Do (this, volume, voxel_texture_ids, kCubeSize);
-        MergeArea<kMergeAreaYPositive, kLayerTypeY, VolumeType::kHeight, VolumeType::kWidth, VolumeType::kDepth>::Do (this, volume, voxel_texture_ids, kCubeSize);
-        MergeArea<kMergeAreaYNegative, kLayerTypeY, VolumeType::kHeight, VolumeType::kWidth, VolumeType::kDepth>::Do (this, volume, voxel_texture_ids, kCubeSize);
-        MergeArea<kMergeAreaZPositive, kLayerTypeZ, VolumeType::kDepth, VolumeType::kWidth, VolumeType::kHeight>::Do (this, volume, voxel_texture_ids, kCubeSize);
-        MergeArea<kMergeAreaZNegative, kLayerTypeZ, VolumeType::kDepth, VolumeType::kWidth, VolumeType::kHeight>::Do (this, volume, voxel_texture_ids, kCubeSize);
+        /* Every layer fits into the scratch memory. */
+        const VoxArea layer_size = max (max ((VoxArea) volume.width () * volume.height (), (VoxArea) volume.width () * volume.depth ()),
+            (VoxArea) volume.depth () * volume.height ());
+        ReserveCapacity (layer_flags_, layer_size);
+        ReserveCapacity (layer_shades_, layer_size);
+
+        SizeDispatch<VolumeType::kWidth == kRuntimeSize || VolumeType::kHeight == kRuntimeSize || VolumeType::kDepth == kRuntimeSize>::MergeAreas (
+            this, volume, voxel_texture_ids, kCubeSize, light, border);
 
         runs_ += 1;
         vertices_generated_ += vertices_.iterator ();
 
-        printf ("Memory used for vertices: %u byte\n", vertices_.iterator () * sizeof (Vertex) + indices ().iterator () * sizeof (GLuint)); 
+        VOX_TRACE_COUNTER ("Vertices", vertices_.iterator ());
+        VOX_TRACE_COUNTER ("Indices", indices_.iterator ());
 
         UpdateExpectedVertexCount ();
     }
 
+    inline void set_ambient_occlusion (const bool ambient_occlusion) { ambient_occlusion_ = ambient_occlusion; }
+    inline bool ambient_occlusion () const { return ambient_occlusion_; }
+
     inline RawList<Vertex>& vertices () { return vertices_; }
     inline RawList<IndexType>& indices () { return indices_; }
+
+    /* The memory that the last generated mesh uses. */
+    inline size_t mesh_size () { return vertices_.iterator () * sizeof (Vertex) + indices_.iterator () * sizeof (IndexType); }
 };
 
 }
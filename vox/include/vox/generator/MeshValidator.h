@@ -0,0 +1,291 @@
+#ifndef VOX_GENERATOR_MESHVALIDATOR_H_
+#define VOX_GENERATOR_MESHVALIDATOR_H_
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <coin/gl.h>
+
+#include <vox/Visibility.h>
+#include <vox/Volume.h>
+#include <vox/generator/CubeGenerator.h>
+#include <vox/generator/ReferenceGenerator.h>
+#include <vox/util/RawList.h>
+
+
+namespace vox {
+
+/*
+ * Checks that the quads of a generator cover exactly the faces that the ReferenceGenerator emits.
+ *
+ * Both meshes are rasterised back to a coverage grid with one cell per voxel and face direction.
+ * Every visible face has to be covered exactly once and with the texture of its voxel,
+ * while hidden faces must not be covered at all. Quads also have to be axis aligned,
+ * lie inside the volume and be indexed as two triangles of their own four vertices
+ * that split the quad along a diagonal and are wound counterclockwise around the normal.
+ */
+template <typename VoxelType, typename VolumeType, typename IndexType = GLuint, VoxelType kEmptyCubeIndex = 0>
+class MeshValidator {
+public:
+    typedef typename CubeGenerator<VoxelType, VolumeType, IndexType, kEmptyCubeIndex>::Vertex Vertex;
+
+    struct Result {
+        u32 quads;
+        u32 reference_quads;
+        u32 missing_faces;      /* Visible faces that no quad covers. */
+        u32 hidden_faces;       /* Covered faces that aren't visible. */
+        u32 overlapping_faces;  /* Faces covered more than once. */
+        u32 texture_mismatches;
+        u32 invalid_quads;
+
+        Result () {
+            memset (this, 0, sizeof (Result));
+        }
+
+        inline bool Passed () const {
+            return missing_faces == 0 && hidden_faces == 0 && overlapping_faces == 0 &&
+                texture_mismatches == 0 && invalid_quads == 0;
+        }
+
+        /* The quad count relative to the reference. Lower is better. */
+        inline float efficiency () const {
+            return (reference_quads > 0) ? (float) quads / reference_quads : 1.0f;
+        }
+
+        void Print (const char* name) const {
+            printf ("%s: %s, %u quads (reference %u, %.1f%%)", name, Passed () ? "passed" : "FAILED",
+                quads, reference_quads, efficiency () * 100.0f);
+            if (!Passed ()) {
+                printf (", %u missing, %u hidden, %u overlapping, %u texture mismatches, %u invalid quads",
+                    missing_faces, hidden_faces, overlapping_faces, texture_mismatches, invalid_quads);
+            }
+            printf ("\n");
+        }
+    };
+
+private:
+    ReferenceGenerator<VoxelType, VolumeType, IndexType, kEmptyCubeIndex> reference_;
+
+    /* Per face direction: how often each voxel face is covered and with which texture. */
+    RawList<u8> coverage_[kFaceCount];
+    RawList<float> textures_[kFaceCount];
+    RawList<u8> reference_coverage_[kFaceCount];
+    RawList<float> reference_textures_[kFaceCount];
+
+    inline static int GetFace (const Vertex& vertex) {
+        if (vertex.normal_x > 0.5f) return kFaceXPositive;
+        if (vertex.normal_x < -0.5f) return kFaceXNegative;
+        if (vertex.normal_y > 0.5f) return kFaceYPositive;
+        if (vertex.normal_y < -0.5f) return kFaceYNegative;
+        if (vertex.normal_z > 0.5f) return kFaceZPositive;
+        if (vertex.normal_z < -0.5f) return kFaceZNegative;
+        return -1;
+    }
+
+    inline static int ToVoxelCoordinate (const GLfloat position, const GLuint volume_position, const float kCubeSize) {
+        return (int) floorf (position / kCubeSize - volume_position + 0.5f);
+    }
+
+    /*
+     * Whether the vertices are the four corners of the quad and the indices two triangles that
+     * cover it exactly once, facing along the normal. 'positions' are in voxel coordinates.
+     */
+    inline static bool AreTrianglesValid (const int positions[4][3], const int min[3], const int max[3], const int face,
+                                          const IndexType* triangles, const IndexType first_vertex) {
+        const int normal_axis = face / 2;
+        const int u = (normal_axis + 1) % 3;
+        const int w = (normal_axis + 2) % 3;
+
+        /* Corner of each vertex, bit 0 set at the maximum of u and bit 1 at the maximum of w. */
+        int corners[4];
+        bool corner_used[4] = { false, false, false, false };
+        for (int v = 0; v < 4; ++v) {
+            if ((positions[v][u] != min[u] && positions[v][u] != max[u]) ||
+                (positions[v][w] != min[w] && positions[v][w] != max[w])) return false;
+
+            corners[v] = ((positions[v][u] == max[u]) ? 1 : 0) | ((positions[v][w] == max[w]) ? 2 : 0);
+            if (corner_used[corners[v]]) return false;
+            corner_used[corners[v]] = true;
+        }
+
+        int uses[4] = { 0, 0, 0, 0 };
+        const int facing = (face % 2 == 1) ? 1 : -1;
+        for (int t = 0; t < 2; ++t) {
+            const int a = (int) (triangles[t * 3] - first_vertex);
+            const int b = (int) (triangles[t * 3 + 1] - first_vertex);
+            const int c = (int) (triangles[t * 3 + 2] - first_vertex);
+            if (a == b || b == c || a == c) return false;
+            uses[a] += 1;
+            uses[b] += 1;
+            uses[c] += 1;
+
+            /* Counterclockwise seen from the front, so the cross product points along the normal. */
+            const int cross = (positions[b][u] - positions[a][u]) * (positions[c][w] - positions[a][w]) -
+                (positions[b][w] - positions[a][w]) * (positions[c][u] - positions[a][u]);
+            if (cross * facing <= 0) return false;
+        }
+
+        /* The triangles share an edge, which has to be a diagonal or they would overlap. */
+        int shared_corners = 0;
+        int shared_count = 0;
+        for (int v = 0; v < 4; ++v) {
+            if (uses[v] == 0) return false;
+            if (uses[v] == 2) {
+                shared_corners ^= corners[v];
+                ++shared_count;
+            }
+        }
+        return shared_count == 2 && shared_corners == 3;
+    }
+
+    /* Returns the number of invalid quads. */
+    u32 Rasterise (VolumeType& volume, const float kCubeSize, RawList<Vertex>& vertices, RawList<IndexType>& indices,
+                   RawList<u8>* coverage, RawList<float>* textures) {
+        for (int face = 0; face < kFaceCount; ++face) {
+            memset (coverage[face].data (), 0, volume.volume () * sizeof (u8));
+        }
+
+        const size_t quad_count = vertices.iterator () / 4;
+        u32 invalid_quads = 0;
+        if (vertices.iterator () % 4 != 0 || indices.iterator () != quad_count * 6) {
+            ++invalid_quads;
+        }
+
+        for (size_t quad = 0; quad < quad_count; ++quad) {
+            const Vertex* quad_vertices = vertices.data () + quad * 4;
+
+            /* Both triangles may only use the quad's own vertices. */
+            bool valid = true;
+            const bool indexed = (quad + 1) * 6 <= indices.iterator ();
+            if (indexed) {
+                for (size_t i = quad * 6; i < (quad + 1) * 6; ++i) {
+                    if (indices[i] < quad * 4 || indices[i] >= (quad + 1) * 4) valid = false;
+                }
+            }
+
+            const int face = GetFace (quad_vertices[0]);
+            int positions[4][3];
+            int min[3] = { 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF };
+            int max[3] = { -0x7FFFFFFF, -0x7FFFFFFF, -0x7FFFFFFF };
+            for (int v = 0; v < 4; ++v) {
+                int* position = positions[v];
+                position[0] = ToVoxelCoordinate (quad_vertices[v].x, volume.x (), kCubeSize);
+                position[1] = ToVoxelCoordinate (quad_vertices[v].y, volume.y (), kCubeSize);
+                position[2] = ToVoxelCoordinate (quad_vertices[v].z, volume.z (), kCubeSize);
+                for (int axis = 0; axis < 3; ++axis) {
+                    if (position[axis] < min[axis]) min[axis] = position[axis];
+                    if (position[axis] > max[axis]) max[axis] = position[axis];
+                }
+                if (GetFace (quad_vertices[v]) != face || quad_vertices[v].texture_id != quad_vertices[0].texture_id) valid = false;
+            }
+
+            /* Flat along the normal, not degenerate, inside the volume. */
+            const int normal_axis = face / 2;
+            const int size[3] = { volume.width (), volume.height (), volume.depth () };
+            if (face < 0 || min[normal_axis] != max[normal_axis]) valid = false;
+            for (int axis = 0; valid && axis < 3; ++axis) {
+                if (min[axis] < 0 || max[axis] > size[axis]) valid = false;
+                if (axis != normal_axis && min[axis] == max[axis]) valid = false;
+            }
+            if (valid && indexed && !AreTrianglesValid (positions, min, max, face, indices.data () + quad * 6, (IndexType) (quad * 4))) {
+                valid = false;
+            }
+            if (!valid) {
+                ++invalid_quads;
+                continue;
+            }
+
+            /* A positive face at coordinate c belongs to the voxel at c - 1. */
+            if (face % 2 == 1) {
+                min[normal_axis] -= 1;
+            }
+            if (min[normal_axis] < 0 || min[normal_axis] >= size[normal_axis]) {
+                ++invalid_quads;
+                continue;
+            }
+            max[normal_axis] = min[normal_axis] + 1;
+
+            for (int y = min[1]; y < max[1]; ++y) {
+                for (int z = min[2]; z < max[2]; ++z) {
+                    for (int x = min[0]; x < max[0]; ++x) {
+                        const size_t index = volume.GetVoxelIndex ((VoxPos) x, (VoxPos) y, (VoxPos) z);
+                        if (coverage[face][index] < 0xFF) {
+                            coverage[face][index] += 1;
+                        }
+                        textures[face][index] = quad_vertices[0].texture_id;
+                    }
+                }
+            }
+        }
+
+        return invalid_quads;
+    }
+
+
+    template<typename T>
+    inline static void ReserveCapacity (RawList<T>& list, size_t needed) {
+        if (needed > list.size ()) {
+            list.Resize (needed);
+        }
+    }
+
+
+public:
+
+    /* Validates the mesh that 'vertices' and 'indices' hold for the volume. */
+    Result Validate (VolumeType& volume, float* voxel_texture_ids, const float kCubeSize,
+                     RawList<Vertex>& vertices, RawList<IndexType>& indices) {
+        Result result;
+
+        /* Volumes may be sized at runtime, so the grids grow with the largest one. */
+        for (int face = 0; face < kFaceCount; ++face) {
+            ReserveCapacity (coverage_[face], volume.volume ());
+            ReserveCapacity (textures_[face], volume.volume ());
+            ReserveCapacity (reference_coverage_[face], volume.volume ());
+            ReserveCapacity (reference_textures_[face], volume.volume ());
+        }
+
+        reference_.Generate (volume, voxel_texture_ids, kCubeSize);
+        result.reference_quads = (u32) (reference_.vertices ().iterator () / 4);
+        result.quads = (u32) (vertices.iterator () / 4);
+
+        /* The reference is valid by construction, but the rasteriser has to agree. */
+        result.invalid_quads += Rasterise (volume, kCubeSize, reference_.vertices (), reference_.indices (), reference_coverage_, reference_textures_);
+        result.invalid_quads += Rasterise (volume, kCubeSize, vertices, indices, coverage_, textures_);
+
+        for (int face = 0; face < kFaceCount; ++face) {
+            for (size_t index = 0; index < volume.volume (); ++index) {
+                const u8 expected = reference_coverage_[face][index];
+                const u8 covered = coverage_[face][index];
+
+                if (covered > 1) {
+                    ++result.overlapping_faces;
+                }
+                if (expected > 0 && covered == 0) {
+                    ++result.missing_faces;
+                }else if (expected == 0 && covered > 0) {
+                    ++result.hidden_faces;
+                }else if (expected > 0 && textures_[face][index] != reference_textures_[face][index]) {
+                    ++result.texture_mismatches;
+                }
+            }
+        }
+
+        return result;
+    }
+
+    /* Generates the mesh of the volume with 'generator' and validates it. */
+    template<typename GeneratorType>
+    Result Validate (GeneratorType& generator, VolumeType& volume, float* voxel_texture_ids, const float kCubeSize) {
+        generator.Generate (volume, voxel_texture_ids, kCubeSize);
+        return Validate (volume, voxel_texture_ids, kCubeSize, generator.vertices (), generator.indices ());
+    }
+
+    inline ReferenceGenerator<VoxelType, VolumeType, IndexType, kEmptyCubeIndex>& reference () { return reference_; }
+};
+
+}
+
+
+#endif  /* VOX_GENERATOR_MESHVALIDATOR_H_ */
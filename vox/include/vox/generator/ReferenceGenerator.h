@@ -0,0 +1,144 @@
+#ifndef VOX_GENERATOR_REFERENCEGENERATOR_H_
+#define VOX_GENERATOR_REFERENCEGENERATOR_H_
+
+#include <coin/gl.h>
+
+#include <vox/Visibility.h>
+#include <vox/Volume.h>
+#include <vox/generator/CubeGenerator.h>
+#include <vox/util/RawList.h>
+
+
+namespace vox {
+
+/*
+ * The naive mesher: one quad per visible voxel face, no merging.
+ * It is slow on purpose and exists as the ground truth for MeshValidator.
+ * Vertices and indices have the same layout and winding as those of CubeGenerator.
+ */
+template <typename VoxelType, typename VolumeType, typename IndexType = GLuint, VoxelType kEmptyCubeIndex = 0>
+class ReferenceGenerator {
+public:
+    typedef typename CubeGenerator<VoxelType, VolumeType, IndexType, kEmptyCubeIndex>::Vertex Vertex;
+
+private:
+    RawList<Vertex> vertices_;
+    RawList<IndexType> indices_;
+
+    template<typename T>
+    inline void ReserveCapacity (RawList<T>& list, size_t needed) {
+        if (needed > list.size ()) {
+            list.Resize (needed);
+        }
+    }
+
+    inline bool IsFaceVisible (VolumeType& volume, const VoxPos x, const VoxPos y, const VoxPos z, const int face) {
+        VoxPos nx = x, ny = y, nz = z;
+        switch (face) {
+        case kFaceXNegative: nx -= 1; break;
+        case kFaceXPositive: nx += 1; break;
+        case kFaceYNegative: ny -= 1; break;
+        case kFaceYPositive: ny += 1; break;
+        case kFaceZNegative: nz -= 1; break;
+        case kFaceZPositive: nz += 1; break;
+        }
+
+        /* Faces on the border of the volume are always visible. */
+        if (volume.PositionOutOfBounds (nx, ny, nz)) {
+            return true;
+        }
+        return volume.GetVoxel (nx, ny, nz) == kEmptyCubeIndex;
+    }
+
+    void AddQuad (VolumeType& volume, const float kCubeSize, const VoxPos x, const VoxPos y, const VoxPos z, const int face, const float texture_id) {
+        /* Open and lit by the sky, see CubeGenerator::Vertex. */
+        const GLfloat shade = (GLfloat) (0x03 | (0xF0 << 2));
+
+        const GLfloat x0 = x * kCubeSize;
+        const GLfloat y0 = y * kCubeSize;
+        const GLfloat z0 = z * kCubeSize;
+        const GLfloat x1 = x0 + kCubeSize;
+        const GLfloat y1 = y0 + kCubeSize;
+        const GLfloat z1 = z0 + kCubeSize;
+
+        ReserveCapacity (vertices_, vertices_.iterator () + 4);
+        const IndexType vertex_0 = (IndexType) vertices_.iterator ();
+
+        switch (face) {
+        case kFaceXPositive:
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y0, z0,    1.0f, 0.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y1, z0,    1.0f, 0.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y1, z1,    1.0f, 0.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y0, z1,    1.0f, 0.0f, 0.0f, texture_id, shade);
+            break;
+        case kFaceXNegative:
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y0, z0,    -1.0f, 0.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y0, z1,    -1.0f, 0.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y1, z1,    -1.0f, 0.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y1, z0,    -1.0f, 0.0f, 0.0f, texture_id, shade);
+            break;
+        case kFaceYPositive:
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y1, z0,    0.0f, 1.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y1, z1,    0.0f, 1.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y1, z1,    0.0f, 1.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y1, z0,    0.0f, 1.0f, 0.0f, texture_id, shade);
+            break;
+        case kFaceYNegative:
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y0, z0,    0.0f, -1.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y0, z0,    0.0f, -1.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y0, z1,    0.0f, -1.0f, 0.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y0, z1,    0.0f, -1.0f, 0.0f, texture_id, shade);
+            break;
+        case kFaceZPositive:
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y0, z1,    0.0f, 0.0f, 1.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y0, z1,    0.0f, 0.0f, 1.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y1, z1,    0.0f, 0.0f, 1.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y1, z1,    0.0f, 0.0f, 1.0f, texture_id, shade);
+            break;
+        case kFaceZNegative:
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y0, z0,    0.0f, 0.0f, -1.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x0, y1, z0,    0.0f, 0.0f, -1.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y1, z0,    0.0f, 0.0f, -1.0f, texture_id, shade);
+            vertices_.Next () = Vertex (volume, kCubeSize, x1, y0, z0,    0.0f, 0.0f, -1.0f, texture_id, shade);
+            break;
+        }
+
+        ReserveCapacity (indices_, indices_.iterator () + 6);
+        indices_.Next () = vertex_0;
+        indices_.Next () = vertex_0 + 1;
+        indices_.Next () = vertex_0 + 2;
+        indices_.Next () = vertex_0 + 2;
+        indices_.Next () = vertex_0 + 3;
+        indices_.Next () = vertex_0;
+    }
+
+
+public:
+    void Generate (VolumeType& volume, float* voxel_texture_ids, const float kCubeSize) {
+        vertices_.ResetIterator ();
+        indices_.ResetIterator ();
+
+        for (VoxPos y = 0; y < volume.height (); ++y) {
+            for (VoxPos z = 0; z < volume.depth (); ++z) {
+                for (VoxPos x = 0; x < volume.width (); ++x) {
+                    const VoxelType voxel = volume.GetVoxel (x, y, z);
+                    if (voxel == kEmptyCubeIndex) continue;
+
+                    for (int face = 0; face < kFaceCount; ++face) {
+                        if (IsFaceVisible (volume, x, y, z, face)) {
+                            AddQuad (volume, kCubeSize, x, y, z, face, voxel_texture_ids[voxel]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    inline RawList<Vertex>& vertices () { return vertices_; }
+    inline RawList<IndexType>& indices () { return indices_; }
+};
+
+}
+
+
+#endif  /* VOX_GENERATOR_REFERENCEGENERATOR_H_ */
@@ -3,6 +3,8 @@
 
 #include <stdlib.h>
 
+#include <vox/util/Trace.h>
+
 
 namespace vox {
 
@@ -41,9 +43,11 @@ public:
         }
         
         if (resize) {
+            VOX_TRACE_BEGIN ("RawList::Resize");
             size_ = new_size;
             data_ = (T*) realloc (data_, size_ * sizeof (T));
             CheckAllocationError ();
+            VOX_TRACE_END ("RawList::Resize");
         }
     }
 
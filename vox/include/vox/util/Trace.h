@@ -0,0 +1,336 @@
+#ifndef VOX_UTILS_TRACE_H_
+#define VOX_UTILS_TRACE_H_
+
+/*
+ * Lightweight zone and counter tracing.
+ *
+ * Define VOX_TRACE to compile the tracing layer in. Without it, every VOX_TRACE_* macro
+ * expands to nothing, so instrumented code carries no overhead at all.
+ *
+ * Each thread records its events into its own ring buffer, which it alone writes to.
+ * Recording therefore needs no locks, only a timestamp and a relaxed store.
+ * VOX_TRACE_DUMP writes all buffers as Chrome trace JSON (chrome://tracing, Perfetto),
+ * with one track per thread. Dump only while traced threads are idle.
+ *
+ * Zone and counter names must be string literals (or otherwise outlive the dump).
+ *
+ * Every event reads the clock, so keep zones out of code that runs many times per frame.
+ * For such code, sum up its time with VOX_TRACE_TOTAL and VOX_TRACE_ACCUMULATE
+ * and record the total once with VOX_TRACE_COUNTER. The cleanup of a scoped zone also
+ * keeps the compiler from optimizing hot inlined functions as well as it otherwise would,
+ * so wrap calls to those in VOX_TRACE_BEGIN and VOX_TRACE_END instead.
+ */
+
+#ifdef VOX_TRACE
+
+#include <stdio.h>
+#include <atomic>
+
+#include <coin/coin.h>
+#include <coin/utils/time.h>
+
+
+#ifdef _MSC_VER
+#define VOX_THREAD_LOCAL __declspec(thread)
+#else
+#define VOX_THREAD_LOCAL __thread
+#endif
+
+/* Compilers with C++11 thread_local run destructors on thread exit, which lets exiting threads give back their buffer. */
+#if !defined(_MSC_VER) || _MSC_VER >= 1900
+#define VOX_TRACE_THREAD_EXIT
+#endif
+
+
+namespace vox {
+
+static const u32 kTraceEventBegin = 0;
+static const u32 kTraceEventEnd = 1;
+static const u32 kTraceEventCounter = 2;
+
+static const u32 kTraceMaxThreads = 64;
+
+struct TraceEvent {
+    const char* name;
+    u64 time;
+    i64 value;
+    u32 type;
+    u32 thread_id;
+};
+
+/*
+ * A ring buffer that is written by exactly one thread at a time.
+ * When the buffer is full, the oldest events are overwritten.
+ * Every event carries the id of the thread that wrote it, because a reused buffer
+ * still holds events of the thread that had it before.
+ */
+class TraceBuffer {
+public:
+    static const u32 kSize = 1 << 16; /* Must be a power of two. */
+
+private:
+    TraceEvent events_[kSize];
+    std::atomic<u32> head_;
+    std::atomic<bool> in_use_;
+    u32 thread_id_;
+
+public:
+    TraceBuffer (u32 thread_id) {
+        head_.store (0, std::memory_order_relaxed);
+        in_use_.store (true, std::memory_order_relaxed);
+        thread_id_ = thread_id;
+    }
+
+    /* Takes over the buffer of a thread that has exited. Its events stay until they are overwritten. */
+    inline bool Claim () {
+        bool in_use = false;
+        return in_use_.compare_exchange_strong (in_use, true, std::memory_order_acquire);
+    }
+
+    /* Only the thread that owns the buffer may call this. */
+    inline void set_thread_id (const u32 thread_id) { thread_id_ = thread_id; }
+
+    inline void Release () {
+        in_use_.store (false, std::memory_order_release);
+    }
+
+    inline void Push (const u32 type, const char* name, const i64 value) {
+        const u32 head = head_.load (std::memory_order_relaxed);
+        TraceEvent& event = events_[head & (kSize - 1)];
+        event.name = name;
+        event.time = coin::TimeNanoseconds ();
+        event.value = value;
+        event.type = type;
+        event.thread_id = thread_id_;
+
+        /* Publish the event to a dumping thread. */
+        head_.store (head + 1, std::memory_order_release);
+    }
+
+    inline const TraceEvent& event (u32 index) const { return events_[index & (kSize - 1)]; }
+    inline u32 head () const { return head_.load (std::memory_order_acquire); }
+};
+
+/*
+ * Buffers are never freed, so a dump still contains the events of threads that have already finished.
+ * When a thread exits, the next new thread reuses its buffer (see VOX_TRACE_THREAD_EXIT),
+ * so there are only as many buffers as threads that run at the same time.
+ */
+inline std::atomic<TraceBuffer*>* TraceBuffers () {
+    static std::atomic<TraceBuffer*> buffers[kTraceMaxThreads];
+    return buffers;
+}
+
+inline std::atomic<u32>& TraceBufferCount () {
+    static std::atomic<u32> count;
+    return count;
+}
+
+/* Every thread that gets a buffer gets a new id, and with it its own track in the dump. */
+inline std::atomic<u32>& TraceThreadCount () {
+    static std::atomic<u32> count;
+    return count;
+}
+
+inline TraceBuffer* TraceAcquireBuffer () {
+    const u32 count = min (TraceBufferCount ().load (), kTraceMaxThreads);
+    for (u32 i = 0; i < count; ++i) {
+        TraceBuffer* buffer = TraceBuffers ()[i].load (std::memory_order_acquire);
+        if (buffer != NULL && buffer->Claim ()) {
+            buffer->set_thread_id (TraceThreadCount ().fetch_add (1));
+            return buffer;
+        }
+    }
+
+    const u32 index = TraceBufferCount ().fetch_add (1);
+    if (index >= kTraceMaxThreads) {
+        /* Too many threads at once. Keep the count saturated. */
+        TraceBufferCount ().store (kTraceMaxThreads);
+        return NULL;
+    }
+
+    TraceBuffer* buffer = new TraceBuffer (TraceThreadCount ().fetch_add (1));
+    TraceBuffers ()[index].store (buffer, std::memory_order_release);
+    return buffer;
+}
+
+#ifdef VOX_TRACE_THREAD_EXIT
+class TraceThreadExit {
+public:
+    TraceBuffer* buffer;
+
+    TraceThreadExit () {
+        buffer = NULL;
+    }
+
+    ~TraceThreadExit () {
+        if (buffer != NULL) {
+            buffer->Release ();
+        }
+    }
+};
+#endif
+
+inline TraceBuffer* TraceLocalBuffer () {
+    static VOX_THREAD_LOCAL TraceBuffer* buffer = NULL;
+    static VOX_THREAD_LOCAL bool dropped = false;
+
+    if (buffer == NULL && !dropped) {
+        buffer = TraceAcquireBuffer ();
+
+        /* Without a buffer, this thread's events are dropped, without touching the shared count again. */
+        if (buffer == NULL) {
+            dropped = true;
+            return NULL;
+        }
+
+        #ifdef VOX_TRACE_THREAD_EXIT
+        static thread_local TraceThreadExit thread_exit;
+        thread_exit.buffer = buffer;
+        #endif
+    }
+
+    return buffer;
+}
+
+inline void TracePush (const u32 type, const char* name, const i64 value) {
+    TraceBuffer* buffer = TraceLocalBuffer ();
+    if (buffer != NULL) {
+        buffer->Push (type, name, value);
+    }
+}
+
+class TraceZone {
+private:
+    const char* name_;
+
+public:
+    TraceZone (const char* name) {
+        name_ = name;
+        TracePush (kTraceEventBegin, name_, 0);
+    }
+
+    ~TraceZone () {
+        TracePush (kTraceEventEnd, name_, 0);
+    }
+};
+
+/* Adds the time spent in its scope to 'total', in nanoseconds. */
+class TraceAccumulator {
+private:
+    u64& total_;
+    u64 start_;
+
+public:
+    TraceAccumulator (u64& total) : total_ (total) {
+        start_ = coin::TimeNanoseconds ();
+    }
+
+    ~TraceAccumulator () {
+        total_ += coin::TimeNanoseconds () - start_;
+    }
+};
+
+/*
+ * Writes the events of all threads as Chrome trace JSON.
+ * Timestamps are in microseconds, relative to the oldest recorded event.
+ */
+inline bool TraceDump (const char* path) {
+    FILE* file = fopen (path, "w");
+    if (file == NULL) {
+        printf ("Error: Could not open trace file '%s'!\n", path);
+        return false;
+    }
+
+    const u32 buffer_count = min (TraceBufferCount ().load (), kTraceMaxThreads);
+
+    /* Find the earliest timestamp that is still in a buffer. */
+    u64 time_origin = (u64) -1;
+    for (u32 i = 0; i < buffer_count; ++i) {
+        const TraceBuffer* buffer = TraceBuffers ()[i].load (std::memory_order_acquire);
+        if (buffer == NULL) continue;
+
+        const u32 head = buffer->head ();
+        const u32 tail = (head > TraceBuffer::kSize) ? head - TraceBuffer::kSize : 0;
+        if (tail < head) {
+            time_origin = min (time_origin, buffer->event (tail).time);
+        }
+    }
+
+    fprintf (file, "{\"traceEvents\":[\n");
+    bool first = true;
+
+    for (u32 i = 0; i < buffer_count; ++i) {
+        const TraceBuffer* buffer = TraceBuffers ()[i].load (std::memory_order_acquire);
+        if (buffer == NULL) continue;
+
+        const u32 head = buffer->head ();
+        const u32 tail = (head > TraceBuffer::kSize) ? head - TraceBuffer::kSize : 0;
+
+        /* Zones whose begin event was overwritten are skipped. */
+        u32 depth = 0;
+        u32 tid = 0;
+        for (u32 e = tail; e < head; ++e) {
+            const TraceEvent& event = buffer->event (e);
+            const double timestamp = (double) (event.time - time_origin) / 1000.0;
+
+            /* Name the track of each thread that wrote to this buffer. Its events follow in one run. */
+            if (e == tail || event.thread_id != tid) {
+                tid = event.thread_id;
+                depth = 0;
+                fprintf (file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}",
+                    first ? "" : ",\n", tid, tid);
+                first = false;
+            }
+
+            switch (event.type) {
+            case kTraceEventBegin:
+                ++depth;
+                fprintf (file, ",\n{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", event.name, timestamp, tid);
+                break;
+            case kTraceEventEnd:
+                if (depth == 0) break;
+                --depth;
+                fprintf (file, ",\n{\"name\":\"%s\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", event.name, timestamp, tid);
+                break;
+            case kTraceEventCounter:
+                fprintf (file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":0,\"tid\":%u,\"args\":{\"value\":%lld}}",
+                    event.name, timestamp, tid, (long long) event.value);
+                break;
+            }
+        }
+    }
+
+    fprintf (file, "\n]}\n");
+    fclose (file);
+    return true;
+}
+
+}
+
+
+#define VOX_TRACE_CONCAT_(a, b) a##b
+#define VOX_TRACE_CONCAT(a, b) VOX_TRACE_CONCAT_(a, b)
+
+#define VOX_TRACE_ZONE(name) ::vox::TraceZone VOX_TRACE_CONCAT(vox_trace_zone_, __LINE__) (name)
+#define VOX_TRACE_BEGIN(name) ::vox::TracePush (::vox::kTraceEventBegin, (name), 0)
+#define VOX_TRACE_END(name) ::vox::TracePush (::vox::kTraceEventEnd, (name), 0)
+#define VOX_TRACE_COUNTER(name, value) ::vox::TracePush (::vox::kTraceEventCounter, (name), (i64) (value))
+#define VOX_TRACE_TOTAL(total) u64 total = 0
+#define VOX_TRACE_ACCUMULATE(total) ::vox::TraceAccumulator VOX_TRACE_CONCAT(vox_trace_accumulator_, __LINE__) (total)
+#define VOX_TRACE_DUMP(path) ::vox::TraceDump (path)
+
+#else
+
+#define VOX_TRACE_ZONE(name)
+#define VOX_TRACE_BEGIN(name)
+#define VOX_TRACE_END(name)
+#define VOX_TRACE_COUNTER(name, value)
+#define VOX_TRACE_TOTAL(total)
+#define VOX_TRACE_ACCUMULATE(total)
+#define VOX_TRACE_DUMP(path)
+
+#endif
+
+
+#endif  /* VOX_UTILS_TRACE_H_ */
@@ -11,6 +11,9 @@ typedef u16     VoxSize;
 typedef u32     VoxArea;
 typedef u32     VoxVolume;
 
+/* A volume size of 0 is given at runtime instead of at compile time. */
+static const VoxSize kRuntimeSize = 0;
+
 }
 
 
@@ -0,0 +1,256 @@
+#ifndef VOX_WORLD_NOISE_H_
+#define VOX_WORLD_NOISE_H_
+
+#include <math.h>
+#include <emmintrin.h>
+
+#include <coin/coin.h>
+
+
+namespace vox {
+
+/*
+ * Gradient (Perlin) and value noise, evaluated for four sample points at once with SSE2.
+ * The tables are read-only after construction, so one Noise object can be shared by
+ * any number of threads.
+ *
+ * Perlin noise returns values in roughly [-1, 1], value noise in exactly [-1, 1].
+ */
+class Noise {
+private:
+    static const int kTableSize = 256;
+    static const int kTableMask = kTableSize - 1;
+
+    /* Doubled, so that perm_[perm_[x] + y] never needs another mask. */
+    int perm_[kTableSize * 2];
+
+    float gradient_2_x_[kTableSize];
+    float gradient_2_y_[kTableSize];
+    float gradient_3_x_[kTableSize];
+    float gradient_3_y_[kTableSize];
+    float gradient_3_z_[kTableSize];
+    float values_[kTableSize];
+
+    /* xorshift32, so a seed always produces the same world regardless of the CRT. */
+    static inline u32 NextRandom (u32& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    static inline __m128 Floor (__m128 x) {
+        const __m128 truncated = _mm_cvtepi32_ps (_mm_cvttps_epi32 (x));
+        return _mm_sub_ps (truncated, _mm_and_ps (_mm_cmpgt_ps (truncated, x), _mm_set1_ps (1.0f)));
+    }
+
+    /* 6t^5 - 15t^4 + 10t^3 */
+    static inline __m128 Fade (__m128 t) {
+        __m128 r = _mm_sub_ps (_mm_mul_ps (t, _mm_set1_ps (6.0f)), _mm_set1_ps (15.0f));
+        r = _mm_add_ps (_mm_mul_ps (r, t), _mm_set1_ps (10.0f));
+        return _mm_mul_ps (_mm_mul_ps (_mm_mul_ps (r, t), t), t);
+    }
+
+    static inline __m128 Lerp (__m128 t, __m128 a, __m128 b) {
+        return _mm_add_ps (a, _mm_mul_ps (t, _mm_sub_ps (b, a)));
+    }
+
+    static inline __m128 Gather (const float* table, const int* index) {
+        return _mm_setr_ps (table[index[0]], table[index[1]], table[index[2]], table[index[3]]);
+    }
+
+    inline __m128 Gradient2 (const int* hash, __m128 x, __m128 y) const {
+        return _mm_add_ps (_mm_mul_ps (Gather (gradient_2_x_, hash), x), _mm_mul_ps (Gather (gradient_2_y_, hash), y));
+    }
+
+    inline __m128 Gradient3 (const int* hash, __m128 x, __m128 y, __m128 z) const {
+        return _mm_add_ps (_mm_add_ps (
+            _mm_mul_ps (Gather (gradient_3_x_, hash), x),
+            _mm_mul_ps (Gather (gradient_3_y_, hash), y)),
+            _mm_mul_ps (Gather (gradient_3_z_, hash), z));
+    }
+
+
+public:
+    Noise (u32 seed) {
+        u32 state = seed * 2654435761u + 1; /* Zero is a fixed point of xorshift. */
+        if (state == 0) state = 1;
+
+        for (int i = 0; i < kTableSize; ++i) {
+            perm_[i] = i;
+        }
+        for (int i = kTableSize - 1; i > 0; --i) {
+            const int j = (int) (NextRandom (state) % (u32) (i + 1));
+            const int swap = perm_[i];
+            perm_[i] = perm_[j];
+            perm_[j] = swap;
+        }
+        for (int i = 0; i < kTableSize; ++i) {
+            perm_[kTableSize + i] = perm_[i];
+        }
+
+        /* 2D gradients are evenly spaced unit vectors. */
+        for (int i = 0; i < kTableSize; ++i) {
+            const float angle = (float) i * (6.28318530718f / kTableSize);
+            gradient_2_x_[i] = cosf (angle);
+            gradient_2_y_[i] = sinf (angle);
+        }
+
+        /* 3D gradients are the twelve cube edge directions from improved Perlin noise. */
+        static const float kEdges[12][3] = {
+            { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+            { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+            { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 }
+        };
+        for (int i = 0; i < kTableSize; ++i) {
+            const float* edge = kEdges[i % 12];
+            gradient_3_x_[i] = edge[0];
+            gradient_3_y_[i] = edge[1];
+            gradient_3_z_[i] = edge[2];
+        }
+
+        for (int i = 0; i < kTableSize; ++i) {
+            values_[i] = (float) (NextRandom (state) & 0xFFFF) / 32767.5f - 1.0f;
+        }
+    }
+
+    __m128 Perlin2 (__m128 x, __m128 y) const {
+        const __m128 x_floor = Floor (x);
+        const __m128 y_floor = Floor (y);
+        const __m128 xf = _mm_sub_ps (x, x_floor);
+        const __m128 yf = _mm_sub_ps (y, y_floor);
+        const __m128 one = _mm_set1_ps (1.0f);
+
+        int xi[4], yi[4];
+        _mm_storeu_si128 ((__m128i*) xi, _mm_cvttps_epi32 (x_floor));
+        _mm_storeu_si128 ((__m128i*) yi, _mm_cvttps_epi32 (y_floor));
+
+        int h00[4], h10[4], h01[4], h11[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            const int a = perm_[xi[lane] & kTableMask];
+            const int b = perm_[(xi[lane] + 1) & kTableMask];
+            const int y0 = yi[lane] & kTableMask;
+            h00[lane] = perm_[a + y0];
+            h10[lane] = perm_[b + y0];
+            h01[lane] = perm_[a + y0 + 1];
+            h11[lane] = perm_[b + y0 + 1];
+        }
+
+        const __m128 xf1 = _mm_sub_ps (xf, one);
+        const __m128 yf1 = _mm_sub_ps (yf, one);
+        const __m128 u = Fade (xf);
+        const __m128 v = Fade (yf);
+
+        const __m128 x0 = Lerp (u, Gradient2 (h00, xf, yf), Gradient2 (h10, xf1, yf));
+        const __m128 x1 = Lerp (u, Gradient2 (h01, xf, yf1), Gradient2 (h11, xf1, yf1));
+
+        /* Unit gradients peak at sqrt(0.5), so scale to roughly [-1, 1]. */
+        return _mm_mul_ps (Lerp (v, x0, x1), _mm_set1_ps (1.41421356f));
+    }
+
+    __m128 Perlin3 (__m128 x, __m128 y, __m128 z) const {
+        const __m128 x_floor = Floor (x);
+        const __m128 y_floor = Floor (y);
+        const __m128 z_floor = Floor (z);
+        const __m128 xf = _mm_sub_ps (x, x_floor);
+        const __m128 yf = _mm_sub_ps (y, y_floor);
+        const __m128 zf = _mm_sub_ps (z, z_floor);
+        const __m128 one = _mm_set1_ps (1.0f);
+
+        int xi[4], yi[4], zi[4];
+        _mm_storeu_si128 ((__m128i*) xi, _mm_cvttps_epi32 (x_floor));
+        _mm_storeu_si128 ((__m128i*) yi, _mm_cvttps_epi32 (y_floor));
+        _mm_storeu_si128 ((__m128i*) zi, _mm_cvttps_epi32 (z_floor));
+
+        int h000[4], h100[4], h010[4], h110[4], h001[4], h101[4], h011[4], h111[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            const int a = perm_[xi[lane] & kTableMask] + (yi[lane] & kTableMask);
+            const int b = perm_[(xi[lane] + 1) & kTableMask] + (yi[lane] & kTableMask);
+            const int aa = perm_[a];
+            const int ab = perm_[a + 1];
+            const int ba = perm_[b];
+            const int bb = perm_[b + 1];
+            const int z0 = zi[lane] & kTableMask;
+            h000[lane] = perm_[aa + z0];
+            h100[lane] = perm_[ba + z0];
+            h010[lane] = perm_[ab + z0];
+            h110[lane] = perm_[bb + z0];
+            h001[lane] = perm_[aa + z0 + 1];
+            h101[lane] = perm_[ba + z0 + 1];
+            h011[lane] = perm_[ab + z0 + 1];
+            h111[lane] = perm_[bb + z0 + 1];
+        }
+
+        const __m128 xf1 = _mm_sub_ps (xf, one);
+        const __m128 yf1 = _mm_sub_ps (yf, one);
+        const __m128 zf1 = _mm_sub_ps (zf, one);
+        const __m128 u = Fade (xf);
+        const __m128 v = Fade (yf);
+        const __m128 w = Fade (zf);
+
+        const __m128 y00 = Lerp (u, Gradient3 (h000, xf, yf, zf), Gradient3 (h100, xf1, yf, zf));
+        const __m128 y10 = Lerp (u, Gradient3 (h010, xf, yf1, zf), Gradient3 (h110, xf1, yf1, zf));
+        const __m128 y01 = Lerp (u, Gradient3 (h001, xf, yf, zf1), Gradient3 (h101, xf1, yf, zf1));
+        const __m128 y11 = Lerp (u, Gradient3 (h011, xf, yf1, zf1), Gradient3 (h111, xf1, yf1, zf1));
+
+        return Lerp (w, Lerp (v, y00, y10), Lerp (v, y01, y11));
+    }
+
+    __m128 Value2 (__m128 x, __m128 y) const {
+        const __m128 x_floor = Floor (x);
+        const __m128 y_floor = Floor (y);
+
+        int xi[4], yi[4];
+        _mm_storeu_si128 ((__m128i*) xi, _mm_cvttps_epi32 (x_floor));
+        _mm_storeu_si128 ((__m128i*) yi, _mm_cvttps_epi32 (y_floor));
+
+        int h00[4], h10[4], h01[4], h11[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            const int a = perm_[xi[lane] & kTableMask];
+            const int b = perm_[(xi[lane] + 1) & kTableMask];
+            const int y0 = yi[lane] & kTableMask;
+            h00[lane] = perm_[a + y0];
+            h10[lane] = perm_[b + y0];
+            h01[lane] = perm_[a + y0 + 1];
+            h11[lane] = perm_[b + y0 + 1];
+        }
+
+        const __m128 u = Fade (_mm_sub_ps (x, x_floor));
+        const __m128 v = Fade (_mm_sub_ps (y, y_floor));
+
+        const __m128 x0 = Lerp (u, Gather (values_, h00), Gather (values_, h10));
+        const __m128 x1 = Lerp (u, Gather (values_, h01), Gather (values_, h11));
+        return Lerp (v, x0, x1);
+    }
+
+    /*
+     * Fractal Brownian motion over Perlin2. Each octave doubles the frequency and halves the amplitude.
+     * The result is normalized to roughly [-1, 1]. Without octaves, it is zero.
+     */
+    __m128 Fractal2 (__m128 x, __m128 y, const u32 octaves) const {
+        __m128 sum = _mm_setzero_ps ();
+        if (octaves == 0) {
+            return sum;
+        }
+
+        float amplitude = 1.0f;
+        float amplitude_sum = 0.0f;
+
+        for (u32 octave = 0; octave < octaves; ++octave) {
+            sum = _mm_add_ps (sum, _mm_mul_ps (Perlin2 (x, y), _mm_set1_ps (amplitude)));
+            amplitude_sum += amplitude;
+            amplitude *= 0.5f;
+
+            /* Offset each octave, so lattice points of different octaves don't line up at the origin. */
+            x = _mm_add_ps (_mm_add_ps (x, x), _mm_set1_ps (17.31f));
+            y = _mm_add_ps (_mm_add_ps (y, y), _mm_set1_ps (-9.17f));
+        }
+
+        return _mm_div_ps (sum, _mm_set1_ps (amplitude_sum));
+    }
+};
+
+}
+
+
+#endif  /* VOX_WORLD_NOISE_H_ */
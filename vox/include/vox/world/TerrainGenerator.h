@@ -0,0 +1,332 @@
+#ifndef VOX_WORLD_TERRAINGENERATOR_H_
+#define VOX_WORLD_TERRAINGENERATOR_H_
+
+#include <math.h>
+#include <emmintrin.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <vox/Volume.h>
+#include <vox/util/RawList.h>
+#include <vox/util/Trace.h>
+#include <vox/world/Noise.h>
+
+
+namespace vox {
+
+template <typename VoxelType>
+struct TerrainMaterialLayer {
+    VoxelType voxel;
+    VoxSize depth;
+};
+
+static const u32 kTerrainMaxMaterialLayers = 8;
+
+template <typename VoxelType>
+struct TerrainSettings {
+    u32 seed;
+
+    float height_base;
+    float height_amplitude;
+    float height_frequency;
+    u32 height_octaves; /* With 0 octaves, the terrain is flat at height_base. */
+
+    /* Caves are carved where the noise is above the threshold. Anything above 1 disables caves. */
+    float cave_frequency;
+    float cave_threshold;
+
+    /* The layer stack moves up or down by at most 'material_jitter' voxels. */
+    float material_frequency;
+    float material_jitter;
+
+    TerrainMaterialLayer<VoxelType> layers[kTerrainMaxMaterialLayers];
+    u32 layer_count;
+    VoxelType fill;
+
+    TerrainSettings () {
+        seed = 0;
+
+        height_base = 32.0f;
+        height_amplitude = 16.0f;
+        height_frequency = 1.0f / 96.0f;
+        height_octaves = 4;
+
+        cave_frequency = 1.0f / 24.0f;
+        cave_threshold = 0.35f;
+
+        material_frequency = 1.0f / 16.0f;
+        material_jitter = 1.5f;
+
+        layer_count = 0;
+        fill = 1;
+    }
+
+    bool AddLayer (const VoxelType voxel, const VoxSize depth) {
+        if (layer_count >= kTerrainMaxMaterialLayers) {
+            return false;
+        }
+        layers[layer_count].voxel = voxel;
+        layers[layer_count].depth = depth;
+        ++layer_count;
+        return true;
+    }
+};
+
+/*
+ * Fills volumes with procedural terrain.
+ *
+ * The surface height of each column comes from fractal Perlin noise. Below the surface,
+ * caves are carved wherever 3D Perlin noise exceeds the cave threshold. Solid voxels get
+ * their material from a stack of layers counted downwards from the surface (e.g. grass,
+ * then dirt), with everything deeper filled by the fill material. Value noise varies
+ * the depth of the layer stack per column.
+ *
+ * Noise is evaluated for four voxels at a time and every column is written with a single
+ * Volume::SetColumn call. Volume positions are in voxels, like everywhere else.
+ *
+ * GenerateParallel spreads volumes over worker threads that the generator starts on first
+ * use and keeps until it is destroyed, so streaming batch after batch costs no thread startup.
+ * Every thread generates into scratch memory of its own, which grows with the largest volume.
+ */
+template <typename VoxelType, typename VolumeType, VoxelType kEmptyCubeIndex = 0>
+class TerrainGenerator {
+public:
+    /* Settings don't depend on the volume, so generators of different volume types can share them. */
+    typedef TerrainSettings<VoxelType> Settings;
+
+    /* The memory Generate works in. Rows and columns are padded to whole groups of four voxels. */
+    struct Scratch {
+        RawList<VoxelType> column;
+        RawList<float> heights;
+        RawList<float> jitters;
+        RawList<float> cave_noise;
+
+        void Reserve (const VolumeType& volume) {
+            const size_t padded_width = (volume.width () + 3) & ~3;
+            const size_t padded_height = (volume.height () + 3) & ~3;
+            if (padded_height > column.size ()) column.Resize (padded_height);
+            if (padded_width > heights.size ()) heights.Resize (padded_width);
+            if (padded_width > jitters.size ()) jitters.Resize (padded_width);
+            if (padded_height > cave_noise.size ()) cave_noise.Resize (padded_height);
+        }
+    };
+
+private:
+    Settings settings_;
+    Noise noise_;
+
+    /* The scratch memory of Generate and of the calling thread of GenerateParallel. */
+    Scratch scratch_;
+
+    /* 'depth' is 0 for the surface voxel and grows downwards. */
+    inline VoxelType GetMaterial (int depth) const {
+        for (u32 i = 0; i < settings_.layer_count; ++i) {
+            depth -= settings_.layers[i].depth;
+            if (depth < 0) {
+                return settings_.layers[i].voxel;
+            }
+        }
+        return settings_.fill;
+    }
+
+    /* The workers of GenerateParallel. Everything but 'batch_next_' is guarded by 'batch_mutex_'. */
+    u32 thread_count_;
+    std::vector<std::thread> workers_;
+    std::mutex batch_mutex_;
+    std::condition_variable batch_started_;
+    std::condition_variable batch_finished_;
+    u32 batch_;
+    u32 workers_busy_;
+    bool stopping_;
+    VolumeType** batch_volumes_;
+    size_t batch_count_;
+    std::atomic<size_t> batch_next_;
+
+    void GenerateBatch (Scratch& scratch) {
+        VOX_TRACE_ZONE ("TerrainGenerator::Worker");
+
+        /* Volumes are handed out one by one, since their generation time depends on the terrain. */
+        for (size_t i = batch_next_.fetch_add (1); i < batch_count_; i = batch_next_.fetch_add (1)) {
+            Generate (*batch_volumes_[i], scratch);
+        }
+    }
+
+    /* 'batch' is the last batch the worker has seen, so a worker that starts late can't miss its first one. */
+    void WorkerLoop (u32 batch) {
+        Scratch scratch;
+        std::unique_lock<std::mutex> lock (batch_mutex_);
+        for (;;) {
+            while (!stopping_ && batch_ == batch) {
+                batch_started_.wait (lock);
+            }
+            if (stopping_) {
+                return;
+            }
+            batch = batch_;
+
+            lock.unlock ();
+            GenerateBatch (scratch);
+            lock.lock ();
+
+            --workers_busy_;
+            if (workers_busy_ == 0) {
+                batch_finished_.notify_one ();
+            }
+        }
+    }
+
+    /* Called with 'batch_mutex_' locked. */
+    void StartWorkers () {
+        for (u32 i = (u32) workers_.size () + 1; i < thread_count_; ++i) {
+            workers_.push_back (std::thread (&TerrainGenerator::WorkerLoop, this, batch_));
+        }
+    }
+
+
+public:
+    /* 'thread_count' is the number of threads of GenerateParallel, including the calling thread. 0 uses one per hardware thread. */
+    TerrainGenerator (const Settings& settings, const u32 thread_count = 0) : noise_ (settings.seed) {
+        settings_ = settings;
+
+        thread_count_ = (thread_count > 0) ? thread_count : max (1u, (u32) std::thread::hardware_concurrency ());
+        batch_ = 0;
+        workers_busy_ = 0;
+        stopping_ = false;
+        batch_volumes_ = NULL;
+        batch_count_ = 0;
+        batch_next_.store (0);
+    }
+
+    ~TerrainGenerator () {
+        {
+            std::lock_guard<std::mutex> lock (batch_mutex_);
+            stopping_ = true;
+        }
+        batch_started_.notify_all ();
+
+        for (size_t i = 0; i < workers_.size (); ++i) {
+            workers_[i].join ();
+        }
+    }
+
+    /* Not thread-safe, see the overload below. */
+    void Generate (VolumeType& volume) {
+        Generate (volume, scratch_);
+    }
+
+    /* Threads can generate at the same time, as long as each one passes scratch memory of its own. */
+    void Generate (VolumeType& volume, Scratch& scratch) const {
+        VOX_TRACE_ZONE ("TerrainGenerator::Generate");
+
+        scratch.Reserve (volume);
+        VoxelType* column = scratch.column.data ();
+        float* heights = scratch.heights.data ();
+        float* jitters = scratch.jitters.data ();
+        float* cave_noise = scratch.cave_noise.data ();
+
+        const VoxSize volume_width = volume.width ();
+        const VoxSize volume_height = volume.height ();
+        const VoxSize volume_depth = volume.depth ();
+        const VoxSize padded_width = (volume_width + 3) & ~3;
+
+        const float origin_x = (float) volume.x ();
+        const float origin_z = (float) volume.z ();
+        const int origin_y = (int) volume.y ();
+
+        const __m128 lane_offsets = _mm_setr_ps (0.0f, 1.0f, 2.0f, 3.0f);
+        const __m128 height_frequency = _mm_set1_ps (settings_.height_frequency);
+        const __m128 cave_frequency = _mm_set1_ps (settings_.cave_frequency);
+        const __m128 material_frequency = _mm_set1_ps (settings_.material_frequency);
+
+        /* Read once, since the scratch stores could alias the settings as far as the compiler knows. */
+        const __m128 height_base = _mm_set1_ps (settings_.height_base);
+        const __m128 height_amplitude = _mm_set1_ps (settings_.height_amplitude);
+        const __m128 material_jitter = _mm_set1_ps (settings_.material_jitter);
+        const u32 height_octaves = settings_.height_octaves;
+        const float cave_threshold = settings_.cave_threshold;
+        const bool caves = cave_threshold <= 1.0f;
+
+        for (VoxPos z = 0; z < volume_depth; ++z) {
+            const __m128 world_z = _mm_set1_ps (origin_z + z);
+
+            /* Heightmap and layer jitter for the whole row. */
+            for (VoxPos x = 0; x < padded_width; x += 4) {
+                const __m128 world_x = _mm_add_ps (_mm_set1_ps (origin_x + x), lane_offsets);
+
+                __m128 height = noise_.Fractal2 (_mm_mul_ps (world_x, height_frequency), _mm_mul_ps (world_z, height_frequency), height_octaves);
+                height = _mm_add_ps (height_base, _mm_mul_ps (height, height_amplitude));
+                _mm_storeu_ps (heights + x, height);
+
+                __m128 jitter = noise_.Value2 (_mm_mul_ps (world_x, material_frequency), _mm_mul_ps (world_z, material_frequency));
+                jitter = _mm_mul_ps (jitter, material_jitter);
+                _mm_storeu_ps (jitters + x, jitter);
+            }
+
+            for (VoxPos x = 0; x < volume_width; ++x) {
+                /* The surface voxel in local coordinates. May lie outside of the volume. */
+                const int surface = (int) floorf (heights[x]) - origin_y;
+                const int solid_end = max (0, min (surface + 1, (int) volume_height));
+                const int jitter = (int) floorf (jitters[x] + 0.5f);
+
+                /* Cave noise is only needed where there is something to carve. */
+                if (caves) {
+                    const __m128 world_x = _mm_set1_ps ((origin_x + x) * settings_.cave_frequency);
+                    const __m128 cave_z = _mm_mul_ps (world_z, cave_frequency);
+                    for (int y = 0; y < solid_end; y += 4) {
+                        const __m128 world_y = _mm_add_ps (_mm_set1_ps ((float) (origin_y + y)), lane_offsets);
+                        _mm_storeu_ps (cave_noise + y, noise_.Perlin3 (world_x, _mm_mul_ps (world_y, cave_frequency), cave_z));
+                    }
+                }
+
+                for (int y = 0; y < solid_end; ++y) {
+                    if (caves && cave_noise[y] > cave_threshold) {
+                        column[y] = kEmptyCubeIndex;
+                    }else {
+                        column[y] = GetMaterial (surface - y + jitter);
+                    }
+                }
+                for (int y = solid_end; y < volume_height; ++y) {
+                    column[y] = kEmptyCubeIndex;
+                }
+
+                volume.SetColumn (x, z, column);
+            }
+        }
+    }
+
+    /* Generates 'count' volumes on all threads of the generator and returns when all of them are done. Not reentrant. */
+    void GenerateParallel (VolumeType** volumes, const size_t count) {
+        VOX_TRACE_ZONE ("TerrainGenerator::GenerateParallel");
+
+        {
+            std::lock_guard<std::mutex> lock (batch_mutex_);
+            StartWorkers ();
+
+            batch_volumes_ = volumes;
+            batch_count_ = count;
+            batch_next_.store (0);
+            workers_busy_ = (u32) workers_.size ();
+            ++batch_;
+        }
+        batch_started_.notify_all ();
+
+        GenerateBatch (scratch_);
+
+        std::unique_lock<std::mutex> lock (batch_mutex_);
+        while (workers_busy_ > 0) {
+            batch_finished_.wait (lock);
+        }
+    }
+
+    inline const Settings& settings () const { return settings_; }
+    inline u32 thread_count () const { return thread_count_; }
+};
+
+}
+
+
+#endif  /* VOX_WORLD_TERRAINGENERATOR_H_ */
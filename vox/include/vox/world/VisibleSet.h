@@ -0,0 +1,152 @@
+#ifndef VOX_WORLD_VISIBLESET_H_
+#define VOX_WORLD_VISIBLESET_H_
+
+#include <string.h>
+
+#include <vox/Visibility.h>
+#include <vox/util/RawList.h>
+#include <vox/util/Trace.h>
+
+
+namespace vox {
+
+/*
+ * Finds the potentially visible set of volumes around a camera. Starting at the camera's volume,
+ * the search only steps from one volume into the next through faces that can see each other
+ * (see VisibilityBuilder). It also never steps back along an axis in the direction opposite
+ * to one it already took, so it can't wrap around solid ground into caves behind it.
+ * Each volume is entered at most once, through whichever face reaches it first.
+ *
+ * Volumes are addressed by grid coordinates. 'LookupType' maps them to volumes:
+ *     VolumeType* operator() (int x, int y, int z) const;
+ * and returns NULL where no volume is loaded. The search stays within 'radius' volumes
+ * of the camera on every axis.
+ */
+template <typename VoxelType, typename VolumeType, typename LookupType, VoxelType kEmptyCubeIndex = 0>
+class VisibleSetSearch {
+private:
+    struct Step {
+        VolumeType* volume;
+        int x, y, z;
+        int entry_face;
+        u32 directions; /* One bit per face the search has stepped out of. */
+    };
+
+    VisibilityBuilder<VoxelType, VolumeType, kEmptyCubeIndex> builder_;
+
+    int radius_;
+    int extent_;
+
+    RawList<Step> queue_;
+    RawList<u8> visited_;
+    RawList<VolumeType*> visible_;
+
+    inline static void GetFaceOffset (const int face, int& dx, int& dy, int& dz) {
+        static const int kOffsets[kFaceCount][3] = {
+            { -1, 0, 0 }, { 1, 0, 0 },
+            { 0, -1, 0 }, { 0, 1, 0 },
+            { 0, 0, -1 }, { 0, 0, 1 }
+        };
+        dx = kOffsets[face][0];
+        dy = kOffsets[face][1];
+        dz = kOffsets[face][2];
+    }
+
+    /* Marks the volume as visible and queues it. Returns false if it was already visited or isn't loaded. */
+    inline bool Enter (const LookupType& lookup, const int camera_x, const int camera_y, const int camera_z,
+                       const int x, const int y, const int z, const int entry_face, const u32 directions, size_t& tail) {
+        const int lx = x - camera_x + radius_;
+        const int ly = y - camera_y + radius_;
+        const int lz = z - camera_z + radius_;
+        if (lx < 0 || lx >= extent_ || ly < 0 || ly >= extent_ || lz < 0 || lz >= extent_) {
+            return false;
+        }
+
+        u8& visited = visited_[(ly * extent_ + lz) * extent_ + lx];
+        if (visited) {
+            return false;
+        }
+        visited = 1;
+
+        VolumeType* volume = lookup (x, y, z);
+        if (volume == NULL) {
+            return false;
+        }
+
+        Step& step = queue_[tail++];
+        step.volume = volume;
+        step.x = x;
+        step.y = y;
+        step.z = z;
+        step.entry_face = entry_face;
+        step.directions = directions;
+
+        visible_.Next () = volume;
+        return true;
+    }
+
+
+public:
+    /* Every volume is queued at most once, so none of the lists has to grow. */
+    VisibleSetSearch (const int radius)
+            : queue_ ((2 * radius + 1) * (2 * radius + 1) * (2 * radius + 1)),
+              visited_ ((2 * radius + 1) * (2 * radius + 1) * (2 * radius + 1)),
+              visible_ ((2 * radius + 1) * (2 * radius + 1) * (2 * radius + 1)) {
+        radius_ = radius;
+        extent_ = 2 * radius + 1;
+    }
+
+    /*
+     * Fills visible () with the volumes that can potentially be seen from the volume at the camera position,
+     * including the camera's volume itself. Returns their count.
+     * Volumes whose air changed are brought up to date on the way.
+     */
+    size_t Find (const LookupType& lookup, const int camera_x, const int camera_y, const int camera_z) {
+        VOX_TRACE_ZONE ("VisibleSetSearch::Find");
+
+        memset (visited_.data (), 0, visited_.size () * sizeof (u8));
+        visible_.ResetIterator ();
+
+        size_t head = 0;
+        size_t tail = 0;
+
+        /* The camera can look out of every face of its own volume. */
+        if (!Enter (lookup, camera_x, camera_y, camera_z, camera_x, camera_y, camera_z, -1, 0, tail)) {
+            return 0;
+        }
+        ++head;
+        for (int face = 0; face < kFaceCount; ++face) {
+            int dx, dy, dz;
+            GetFaceOffset (face, dx, dy, dz);
+            Enter (lookup, camera_x, camera_y, camera_z, camera_x + dx, camera_y + dy, camera_z + dz, GetOppositeFace (face), 1 << face, tail);
+        }
+
+        while (head < tail) {
+            const Step step = queue_[head++];
+            const VoxVisibility visibility = builder_.Update (*step.volume);
+
+            for (int face = 0; face < kFaceCount; ++face) {
+                if (face == step.entry_face) continue;
+                if (step.directions & (1 << GetOppositeFace (face))) continue;
+                if (!CanSeeThrough (visibility, step.entry_face, face)) continue;
+
+                int dx, dy, dz;
+                GetFaceOffset (face, dx, dy, dz);
+                Enter (lookup, camera_x, camera_y, camera_z, step.x + dx, step.y + dy, step.z + dz,
+                       GetOppositeFace (face), step.directions | (1 << face), tail);
+            }
+        }
+
+        VOX_TRACE_COUNTER ("Visible volumes", visible_.iterator ());
+        return visible_.iterator ();
+    }
+
+    inline RawList<VolumeType*>& visible () { return visible_; }
+    inline VisibilityBuilder<VoxelType, VolumeType, kEmptyCubeIndex>& builder () { return builder_; }
+    inline int radius () const { return radius_; }
+};
+
+}
+
+
+#endif  /* VOX_WORLD_VISIBLESET_H_ */
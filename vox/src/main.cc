@@ -3,17 +3,243 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
 
 #include <coin/coin.h>
 #include <coin/utils/time.h>
 
+#include <vox/LightVolume.h>
 #include <vox/Volume.h>
+#include <vox/VolumePool.h>
 #include <vox/generator/CubeGenerator.h>
+#include <vox/generator/MeshValidator.h>
+#include <vox/util/Trace.h>
+#include <vox/world/TerrainGenerator.h>
+#include <vox/world/VisibleSet.h>
 
 using namespace coin;
 using namespace vox;
 
 
+typedef Volume<u16, 32, 32, 32> BlockVolume;
+typedef Volume<u16, kRuntimeSize, kRuntimeSize, kRuntimeSize> RuntimeVolume;
+
+static const int kTerrainChunksX = 16;
+static const int kTerrainChunksY = 2;
+static const int kTerrainChunksZ = 16;
+
+struct TerrainChunkLookup {
+    std::vector<BlockVolume*>* chunks;
+
+    BlockVolume* operator() (int x, int y, int z) const {
+        if (x < 0 || x >= kTerrainChunksX || y < 0 || y >= kTerrainChunksY || z < 0 || z >= kTerrainChunksZ) {
+            return NULL;
+        }
+        return (*chunks)[(y * kTerrainChunksZ + z) * kTerrainChunksX + x];
+    }
+};
+
+
+/*
+ * Validation mode: checks the quads of the CubeGenerator against the ReferenceGenerator
+ * for adversarial and randomized volumes of several sizes.
+ */
+static const int kValidationPatternCount = 10;
+static const int kValidationRandomRuns = 8;
+
+static const char* kValidationPatternNames [kValidationPatternCount] = {
+    "empty",
+    "full",
+    "single voxel",
+    "checkerboard",
+    "random 10%",
+    "random 50%",
+    "random 90%",
+    "random types",
+    "stripes",
+    "terrain"
+};
+
+static u32 validation_random_state = 1;
+
+static u32 ValidationRandom () {
+    validation_random_state ^= validation_random_state << 13;
+    validation_random_state ^= validation_random_state >> 17;
+    validation_random_state ^= validation_random_state << 5;
+    return validation_random_state;
+}
+
+template<typename VolumeType>
+static void FillValidationTerrain (VolumeType& volume, const u32 seed) {
+    typename TerrainGenerator<u16, VolumeType>::Settings settings;
+    settings.seed = seed;
+    settings.height_base = volume.height () * 0.5f;
+    settings.height_amplitude = volume.height () * 0.25f;
+    settings.AddLayer (0x02, 1);
+    settings.AddLayer (0x03, 2);
+    TerrainGenerator<u16, VolumeType> (settings).Generate (volume);
+}
+
+template<typename VolumeType>
+static void FillValidationPattern (VolumeType& volume, const int pattern, const u32 seed) {
+    for (VoxPos y = 0; y < volume.height (); ++y) {
+        for (VoxPos z = 0; z < volume.depth (); ++z) {
+            for (VoxPos x = 0; x < volume.width (); ++x) {
+                const u32 random = ValidationRandom () % 100;
+                u16 voxel = 0;
+                switch (pattern) {
+                case 1: voxel = 1; break;
+                case 2: voxel = (x == volume.width () - 1 && y == volume.height () - 1 && z == volume.depth () - 1) ? 1 : 0; break;
+                case 3: voxel = ((x + y + z) % 2 == 0) ? 1 : 0; break;
+                case 4: voxel = (random < 10) ? 1 : 0; break;
+                case 5: voxel = (random < 50) ? 1 : 0; break;
+                case 6: voxel = (random < 90) ? 1 : 0; break;
+                case 7: voxel = (random < 60) ? (u16) (1 + random % 3) : 0; break;
+                case 8: voxel = (u16) (1 + x % 2); break;
+                }
+                volume.SetVoxel (x, y, z, voxel);
+            }
+        }
+    }
+
+    if (pattern == 9) {
+        FillValidationTerrain (volume, seed);
+    }
+}
+
+template<typename VolumeType>
+static bool ValidateVolume (const char* size_name, float* texture_ids, VolumeType* volume) {
+    CubeGenerator<u16, VolumeType> generator;
+    MeshValidator<u16, VolumeType> validator;
+
+    bool passed = true;
+    for (int ambient_occlusion = 0; ambient_occlusion < 2; ++ambient_occlusion) {
+        generator.set_ambient_occlusion (ambient_occlusion != 0);
+
+        for (int pattern = 0; pattern < kValidationPatternCount; ++pattern) {
+            const int runs = (pattern >= 4) ? kValidationRandomRuns : 1;
+            u32 quads = 0;
+            u32 reference_quads = 0;
+
+            for (int run = 0; run < runs; ++run) {
+                FillValidationPattern (*volume, pattern, (u32) run);
+
+                const typename MeshValidator<u16, VolumeType>::Result result = validator.Validate (generator, *volume, texture_ids, 1.0f);
+                quads += result.quads;
+                reference_quads += result.reference_quads;
+
+                if (!result.Passed ()) {
+                    printf ("%s, %s, run %d%s: ", size_name, kValidationPatternNames[pattern], run, ambient_occlusion ? ", ambient occlusion" : "");
+                    result.Print ("Validation");
+                    passed = false;
+                }
+            }
+
+            printf ("%s, %s%s: %u quads (reference %u, %.1f%%)\n", size_name, kValidationPatternNames[pattern],
+                ambient_occlusion ? ", ambient occlusion" : "", quads, reference_quads,
+                (reference_quads > 0) ? quads * 100.0f / reference_quads : 100.0f);
+        }
+    }
+
+    delete volume;
+    return passed;
+}
+
+template<typename VolumeType>
+static bool ValidateVolumeType (const char* size_name, float* texture_ids) {
+    return ValidateVolume (size_name, texture_ids, new VolumeType (0, 0, 0, true));
+}
+
+static bool ValidateRuntimeVolume (const char* size_name, float* texture_ids, const VoxSize width, const VoxSize height, const VoxSize depth) {
+    return ValidateVolume (size_name, texture_ids, new RuntimeVolume (width, height, depth, 0, 0, 0, true));
+}
+
+
+static const int kBorderCheckWidth = 32;
+
+/*
+ * The shades of the four corners of every floor cell, or -1 where they are unknown. Merged quads only
+ * reveal the shades of their cells when all of their corners have the same shade.
+ */
+static void CollectFloorShades (CubeGenerator<u16, RuntimeVolume>& generator, float* shades) {
+    for (size_t i = 0; i + 3 < generator.vertices ().iterator (); i += 4) {
+        const CubeGenerator<u16, RuntimeVolume>::Vertex* quad = &generator.vertices ()[i];
+        if (quad[0].normal_y != 1.0f || quad[0].y != 1.0f) {
+            continue;
+        }
+
+        int x_min = (int) quad[0].x;
+        int x_max = x_min;
+        int z_min = (int) quad[0].z;
+        int z_max = z_min;
+        for (int v = 1; v < 4; ++v) {
+            x_min = min (x_min, (int) quad[v].x);
+            x_max = max (x_max, (int) quad[v].x);
+            z_min = min (z_min, (int) quad[v].z);
+            z_max = max (z_max, (int) quad[v].z);
+        }
+        const bool uniform = quad[0].shade == quad[1].shade && quad[0].shade == quad[2].shade && quad[0].shade == quad[3].shade;
+        const bool single = x_max - x_min == 1 && z_max - z_min == 1;
+
+        for (int x = x_min; x < x_max; ++x) {
+            for (int z = z_min; z < z_max; ++z) {
+                float* cell = shades + (x * kBorderCheckWidth + z) * 4;
+                for (int v = 0; v < 4; ++v) {
+                    const int corner = ((int) quad[v].x == x_max ? 1 : 0) + ((int) quad[v].z == z_max ? 2 : 0);
+                    cell[corner] = (single || uniform) ? quad[v].shade : -1.0f;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Ambient occlusion across the border of two volumes: a block on either side of the border shades the floor
+ * of the other volume. Meshed with each other as neighbours, both volumes have to give the floor the same
+ * shades as one volume that spans both.
+ */
+static bool CheckBorderOcclusion (float* texture_ids) {
+    const VoxSize size = kBorderCheckWidth;
+    RuntimeVolume both (size * 2, size, size, 0, 0, 0, true);
+    RuntimeVolume left (size, size, size, 0, 0, 0, true);
+    RuntimeVolume right (size, size, size, size, 0, 0, true);
+    both.SetVoxelsInRegion (Region (0, 0, 0, size * 2, 1, size), 0x01);
+    left.SetVoxelsInRegion (Region (0, 0, 0, size, 1, size), 0x01);
+    right.SetVoxelsInRegion (Region (0, 0, 0, size, 1, size), 0x01);
+    both.SetVoxel (size, 1, 5, 0x02);
+    right.SetVoxel (0, 1, 5, 0x02);
+    both.SetVoxel (size - 1, 1, 20, 0x02);
+    left.SetVoxel (size - 1, 1, 20, 0x02);
+
+    std::vector<float> expected (size * 2 * size * 4, -1.0f);
+    std::vector<float> actual (size * 2 * size * 4, -1.0f);
+
+    CubeGenerator<u16, RuntimeVolume> generator;
+    generator.set_ambient_occlusion (true);
+    generator.Generate (both, texture_ids, 1.0f);
+    CollectFloorShades (generator, &expected[0]);
+
+    CubeGenerator<u16, RuntimeVolume>::Border border;
+    border.volumes[kFaceXPositive] = &right;
+    generator.Generate (left, texture_ids, 1.0f, NULL, &border);
+    CollectFloorShades (generator, &actual[0]);
+
+    border.volumes[kFaceXPositive] = NULL;
+    border.volumes[kFaceXNegative] = &left;
+    generator.Generate (right, texture_ids, 1.0f, NULL, &border);
+    CollectFloorShades (generator, &actual[0]);
+
+    for (size_t i = 0; i < expected.size (); ++i) {
+        if (expected[i] >= 0.0f && actual[i] >= 0.0f && expected[i] != actual[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 int main (int argv, char** argc) {
     #ifdef __WIN32__
     ULONG_PTR affinity_mask;
@@ -27,16 +253,33 @@ int main (int argv, char** argc) {
     if (affinity_mask & process_affinity_mask) SetThreadAffinityMask (GetCurrentThread (), affinity_mask);
     #endif
 
-    typedef Volume<u16, 32, 32, 32> BlockVolume;
     typedef Volume<u16, 64, 64, 64> BlockVolumeBig;
 
     TimeInit ();
 
     float texture_ids [] = {
         0.0f,
-        0.0f
+        0.0f,
+        1.0f,
+        2.0f
     };
 
+    if (argv > 1 && strcmp (argc[1], "--validate") == 0) {
+        bool passed = true;
+        passed &= ValidateVolumeType<Volume<u16, 32, 32, 32> > ("32x32x32", texture_ids);
+        passed &= ValidateVolumeType<Volume<u16, 16, 128, 16> > ("16x128x16", texture_ids);
+        passed &= ValidateVolumeType<Volume<u16, 64, 16, 8> > ("64x16x8", texture_ids);
+        passed &= ValidateVolumeType<Volume<u16, 5, 7, 3> > ("5x7x3", texture_ids);
+        passed &= ValidateVolumeType<Volume<u16, 1, 1, 1> > ("1x1x1", texture_ids);
+        passed &= ValidateRuntimeVolume ("runtime 32x32x32", texture_ids, 32, 32, 32);
+        passed &= ValidateRuntimeVolume ("runtime 16x128x16", texture_ids, 16, 128, 16);
+        passed &= ValidateRuntimeVolume ("runtime 24x40x12", texture_ids, 24, 40, 12);
+        passed &= ValidateRuntimeVolume ("runtime 5x7x3", texture_ids, 5, 7, 3);
+        passed &= ValidateRuntimeVolume ("runtime 1x1x1", texture_ids, 1, 1, 1);
+        printf ("Validation %s.\n", passed ? "passed" : "FAILED");
+        return passed ? 0 : 1;
+    }
+
     u64 time = TimeNanoseconds ();
     BlockVolume volume (0, 0, 0, true);
     volume.SetVoxelsInRegion (Region (0, 0, 0, 32, 1, 32), 0x01);
@@ -61,6 +304,10 @@ int main (int argv, char** argc) {
         printf ("Cube merging took %lluns.\n", diff);
     }
     printf ("In sum: %lluns.\n", sum);
+    printf ("Memory used for vertices: %u byte\n", (u32) generator.mesh_size ());
+
+    MeshValidator<u16, BlockVolume> validator;
+    validator.Validate (volume, texture_ids, 0.5f, generator.vertices (), generator.indices ()).Print ("Cube merging");
 
     sum = 0;
     for (int i = 0; i < 8; ++i) {
@@ -72,5 +319,178 @@ int main (int argv, char** argc) {
     }
     printf ("In sum: %lluns.\n", sum);
 
+    MeshValidator<u16, BlockVolumeBig> big_validator;
+    big_validator.Validate (big_volume, texture_ids, 0.5f, big_generator.vertices (), big_generator.indices ()).Print ("Big cube merging");
+
+    /* Terrain generation throughput. */
+    TerrainGenerator<u16, BlockVolume>::Settings terrain_settings;
+    terrain_settings.seed = 1337;
+    terrain_settings.AddLayer (0x02, 1); /* Grass. */
+    terrain_settings.AddLayer (0x03, 3); /* Dirt. */
+    terrain_settings.fill = 0x01;        /* Stone. */
+    TerrainGenerator<u16, BlockVolume> terrain (terrain_settings);
+
+    std::vector<BlockVolume*> chunks;
+    for (int cy = 0; cy < kTerrainChunksY; ++cy) {
+        for (int cz = 0; cz < kTerrainChunksZ; ++cz) {
+            for (int cx = 0; cx < kTerrainChunksX; ++cx) {
+                chunks.push_back (new BlockVolume (cx * BlockVolume::kWidth, cy * BlockVolume::kHeight, cz * BlockVolume::kDepth, true));
+            }
+        }
+    }
+
+    time = TimeNanoseconds ();
+    for (size_t i = 0; i < chunks.size (); ++i) {
+        terrain.Generate (*chunks[i]);
+    }
+    u64 diff = TimeNanoseconds () - time;
+    printf ("Terrain generation of %u chunks took %lluns on one thread (%.1f chunks/s).\n",
+        (u32) chunks.size (), diff, chunks.size () * 1.0e9 / diff);
+
+    /* Streaming in batches, on pools of several sizes. Threads beyond the hardware threads can't scale. */
+    const u32 kTerrainBatchSize = 64;
+    const u32 thread_counts [] = { 1, 2, 4, max (1u, (u32) std::thread::hardware_concurrency ()) };
+    for (int t = 0; t < 4; ++t) {
+        TerrainGenerator<u16, BlockVolume> parallel_terrain (terrain_settings, thread_counts[t]);
+
+        time = TimeNanoseconds ();
+        for (size_t first = 0; first < chunks.size (); first += kTerrainBatchSize) {
+            parallel_terrain.GenerateParallel (&chunks[first], min ((size_t) kTerrainBatchSize, chunks.size () - first));
+        }
+        diff = TimeNanoseconds () - time;
+        printf ("Terrain generation of %u chunks in batches of %u took %lluns on %u threads (%.1f chunks/s, %u hardware threads).\n",
+            (u32) chunks.size (), kTerrainBatchSize, diff, parallel_terrain.thread_count (), chunks.size () * 1.0e9 / diff,
+            (u32) std::thread::hardware_concurrency ());
+    }
+
+    /* Visible set from underground. The first search computes the visibility of every volume it enters. */
+    TerrainChunkLookup lookup;
+    lookup.chunks = &chunks;
+    VisibleSetSearch<u16, BlockVolume, TerrainChunkLookup> visible_set (16);
+
+    for (int i = 0; i < 2; ++i) {
+        time = TimeNanoseconds ();
+        const size_t visible_count = visible_set.Find (lookup, kTerrainChunksX / 2, 0, kTerrainChunksZ / 2);
+        diff = TimeNanoseconds () - time;
+        printf ("Visible set search found %u of %u chunks in %lluns.\n", (u32) visible_count, (u32) chunks.size (), diff);
+    }
+
+    /* Baked ambient occlusion and light on a surface chunk. Its neighbours are lit as well to shade the faces
+        on its border, the chunk below with the sky light that reaches it through the surface chunk. */
+    const int surface_x = kTerrainChunksX / 2;
+    const int surface_z = kTerrainChunksZ / 2;
+    BlockVolume& surface_chunk = *lookup (surface_x, 1, surface_z);
+    LightVolume<u16, BlockVolume> surface_light;
+
+    time = TimeNanoseconds ();
+    surface_light.Propagate (surface_chunk);
+    printf ("Light propagation took %lluns.\n", TimeNanoseconds () - time);
+
+    static const int kFaceOffsets[kFaceCount][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+    LightVolume<u16, BlockVolume> border_light[kFaceCount];
+    CubeGenerator<u16, BlockVolume>::Border surface_border;
+    u8 sky_below[BlockVolume::kLayerSize];
+    surface_light.GetSkyBelow (sky_below);
+    for (int face = 0; face < kFaceCount; ++face) {
+        const BlockVolume* neighbour = lookup (surface_x + kFaceOffsets[face][0], 1 + kFaceOffsets[face][1], surface_z + kFaceOffsets[face][2]);
+        if (neighbour == NULL) { /* Open sky above. */
+            continue;
+        }
+        border_light[face].Propagate (*neighbour, (face == kFaceYNegative) ? sky_below : NULL);
+        surface_border.volumes[face] = neighbour;
+        surface_border.light[face] = border_light[face].data ();
+    }
+    for (int dx = -1; dx <= 1; ++dx) {
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dz = -1; dz <= 1; ++dz) {
+                surface_border.diagonals[dx + 1][dy + 1][dz + 1] = lookup (surface_x + dx, 1 + dy, surface_z + dz);
+            }
+        }
+    }
+
+    generator.Generate (surface_chunk, texture_ids, 0.5f);
+    const size_t flat_vertex_count = generator.vertices ().iterator ();
+
+    generator.set_ambient_occlusion (true);
+    time = TimeNanoseconds ();
+    generator.Generate (surface_chunk, texture_ids, 0.5f, surface_light.data ());
+    printf ("Cube merging with ambient occlusion and light took %lluns (%u vertices, %u without).\n",
+        TimeNanoseconds () - time, (u32) generator.vertices ().iterator (), (u32) flat_vertex_count);
+    validator.Validate (surface_chunk, texture_ids, 0.5f, generator.vertices (), generator.indices ()).Print ("Cube merging with ambient occlusion");
+
+    time = TimeNanoseconds ();
+    generator.Generate (surface_chunk, texture_ids, 0.5f, surface_light.data (), &surface_border);
+    printf ("Cube merging with ambient occlusion and light from the neighbours took %lluns (%u vertices).\n",
+        TimeNanoseconds () - time, (u32) generator.vertices ().iterator ());
+    validator.Validate (surface_chunk, texture_ids, 0.5f, generator.vertices (), generator.indices ()).Print ("Cube merging with neighbour light");
+    generator.set_ambient_occlusion (false);
+    printf ("Ambient occlusion across the border of two volumes %s.\n", CheckBorderOcclusion (texture_ids) ? "matches" : "DOESN'T match");
+
+    /* Streaming volumes in and out, first through the system allocator and then through a pool. */
+    const int kStreamingRounds = 64;
+    const int kStreamingVolumes = 32;
+    RuntimeVolume* streamed [kStreamingVolumes];
+
+    time = TimeNanoseconds ();
+    for (int round = 0; round < kStreamingRounds; ++round) {
+        for (int i = 0; i < kStreamingVolumes; ++i) {
+            streamed[i] = new RuntimeVolume (32, 32, 32, i * 32, 0, round * 32, true);
+        }
+        for (int i = 0; i < kStreamingVolumes; ++i) {
+            delete streamed[i];
+        }
+    }
+    /* Not measured: every volume allocates its object and its slab. */
+    printf ("Streaming %u volumes took %lluns (%u system allocations expected).\n", kStreamingRounds * kStreamingVolumes,
+        TimeNanoseconds () - time, kStreamingRounds * kStreamingVolumes * 2);
+
+    VolumePool<u16> pool (32, 32, 32, kStreamingVolumes / 2, 8);
+    time = TimeNanoseconds ();
+    for (int round = 0; round < kStreamingRounds; ++round) {
+        for (int i = 0; i < kStreamingVolumes; ++i) {
+            streamed[i] = RuntimeVolume::Create (pool, i * 32, 0, round * 32, true);
+        }
+        for (int i = 0; i < kStreamingVolumes; ++i) {
+            RuntimeVolume::Destroy (streamed[i]);
+        }
+    }
+    /* Volumes and slabs both come from the pool, which allocates one block per slabs_per_block slabs. */
+    printf ("Streaming %u pooled volumes took %lluns (%u pool blocks allocated).\n", kStreamingRounds * kStreamingVolumes,
+        TimeNanoseconds () - time, pool.block_count ());
+
+    /* A runtime sized copy of the surface chunk is generated, lit, culled and merged through the same code as BlockVolume. */
+    RuntimeVolume runtime_chunk (pool, surface_chunk.x (), surface_chunk.y (), surface_chunk.z (), true);
+    TerrainGenerator<u16, RuntimeVolume> runtime_terrain (terrain_settings, 1);
+    runtime_terrain.Generate (runtime_chunk);
+    const bool same_voxels = memcmp (runtime_chunk.data (), surface_chunk.data (), surface_chunk.data_size ()) == 0;
+
+    LightVolume<u16, RuntimeVolume> runtime_light;
+    runtime_light.Propagate (runtime_chunk);
+    const bool same_light = memcmp (runtime_light.data (), surface_light.data (), BlockVolume::kVolumeSize) == 0;
+
+    VisibilityBuilder<u16, RuntimeVolume> runtime_visibility;
+    VisibilityBuilder<u16, BlockVolume> visibility;
+    const bool same_visibility = runtime_visibility.Compute (runtime_chunk) == visibility.Compute (surface_chunk);
+    printf ("Terrain, light and visibility of the runtime sized volume %s.\n",
+        (same_voxels && same_light && same_visibility) ? "match" : "DON'T match");
+
+    CubeGenerator<u16, RuntimeVolume> runtime_generator;
+    time = TimeNanoseconds ();
+    runtime_generator.Generate (runtime_chunk, texture_ids, 0.5f);
+    diff = TimeNanoseconds () - time;
+    time = TimeNanoseconds ();
+    generator.Generate (surface_chunk, texture_ids, 0.5f);
+    printf ("Cube merging of a runtime sized volume took %lluns (%lluns with a compile-time size).\n", diff, TimeNanoseconds () - time);
+
+    MeshValidator<u16, RuntimeVolume> runtime_validator;
+    runtime_validator.Validate (runtime_chunk, texture_ids, 0.5f, runtime_generator.vertices (), runtime_generator.indices ()).Print ("Runtime sized cube merging");
+
+    for (size_t i = 0; i < chunks.size (); ++i) {
+        delete chunks[i];
+    }
+
+    /* Only writes a file when compiled with VOX_TRACE. */
+    VOX_TRACE_DUMP ("vox_trace.json");
+
     return 0;
 }
\ No newline at end of file